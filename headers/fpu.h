@@ -0,0 +1,868 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "types.h"
+#include "tools.h"
+
+// x87 register stack, control/status/tag words and arithmetic in two precision
+// modes. FPU_FAST keeps registers as host doubles and computes with host
+// double-precision arithmetic; FPU_EXACT keeps the 80-bit format and computes with
+// the soft-float routines below, honouring the rounding control field.
+//
+// Exceptions are always handled with the masked response: flags are set in the
+// status word (plus ES/B when unmasked) but no #MF is delivered. FPU_FAST arithmetic
+// reports only invalid operation, divide by zero and stack faults. Its conversions
+// still flag what they detect: integer stores set PE when they round, and 80-bit
+// loads/stores go through the soft-float, so narrowing to a double can set PE, OE
+// or UE and widening a denormal double sets DE. Constant loads never set flags.
+
+#define FPU_IE 0x0001 // Invalid operation
+#define FPU_DE 0x0002 // Denormal operand
+#define FPU_ZE 0x0004 // Divide by zero
+#define FPU_OE 0x0008 // Overflow
+#define FPU_UE 0x0010 // Underflow
+#define FPU_PE 0x0020 // Precision
+#define FPU_SF 0x0040 // Stack fault
+#define FPU_ES 0x0080 // Exception summary
+#define FPU_C0 0x0100
+#define FPU_C1 0x0200
+#define FPU_C2 0x0400
+#define FPU_C3 0x4000
+#define FPU_B 0x8000
+
+#define FPU_RC_NEAREST 0
+#define FPU_RC_DOWN 1
+#define FPU_RC_UP 2
+#define FPU_RC_ZERO 3
+
+#define F80_BIAS 16383
+#define F80_J 0x8000000000000000ULL // Explicit integer bit
+#define F80_QUIET 0x4000000000000000ULL
+
+typedef enum {
+    FPU_ADD, // Same order as the reg field of D8/DC
+    FPU_MUL,
+    FPU_COM,
+    FPU_COMP,
+    FPU_SUB,
+    FPU_SUBR,
+    FPU_DIV,
+    FPU_DIVR
+} fpu_op_t;
+
+typedef enum {
+    F80_ZERO,
+    F80_FINITE,
+    F80_INF,
+    F80_NAN,
+    F80_INVALID // Unnormals, pseudo-NaNs and pseudo-infinities
+} f80_class_t;
+
+typedef struct {
+    bool sign;
+    int exp; // Biased; finite values are normalized, so denormals go below 1
+    unsigned long long mant;
+    f80_class_t cls;
+} f80_parts_t;
+
+static const float80_t f80_indefinite = { 0xC000000000000000ULL, 0xFFFF };
+
+void fpu_raise(cpu_state_t *cpu, __uint16_t flags) {
+    cpu->fpu.status |= flags;
+
+    if (cpu->fpu.status & ~cpu->fpu.control & 0x3F) {
+        cpu->fpu.status |= FPU_ES | FPU_B;
+    }
+}
+
+__uint8_t fpu_rc(cpu_state_t *cpu) {
+    return (cpu->fpu.control >> 10) & 3;
+}
+
+// ---- 80-bit soft-float ----
+
+f80_parts_t f80_unpack(float80_t x) {
+    f80_parts_t p;
+    p.sign = x.sign_exp >> 15;
+    p.exp = x.sign_exp & 0x7FFF;
+    p.mant = x.mantissa;
+
+    if (p.exp == 0x7FFF) {
+        p.cls = !(p.mant & F80_J) ? F80_INVALID : (p.mant << 1) ? F80_NAN : F80_INF;
+    } else if (p.exp == 0) {
+        if (p.mant == 0) {
+            p.cls = F80_ZERO;
+        } else { // Denormal (or pseudo-denormal): same scale as exponent 1
+            p.cls = F80_FINITE;
+            p.exp = 1;
+            while (!(p.mant & F80_J)) {
+                p.mant <<= 1;
+                p.exp--;
+            }
+        }
+    } else {
+        p.cls = (p.mant & F80_J) ? F80_FINITE : F80_INVALID;
+    }
+
+    return p;
+}
+
+float80_t f80_make(bool sign, __uint16_t exp, unsigned long long mant) {
+    float80_t x = { mant, (__uint16_t)((sign ? 0x8000 : 0) | exp) };
+    return x;
+}
+
+void f80_shift_right_jam(unsigned long long *mant, unsigned long long *extra, int shift) { // Lost bits stick in extra bit 0
+    unsigned long long m = *mant, e = *extra;
+
+    if (shift <= 0) {
+        return;
+    } else if (shift < 64) {
+        *extra = (m << (64 - shift)) | (e >> shift) | ((e << (64 - shift)) != 0);
+        *mant = m >> shift;
+    } else if (shift == 64) {
+        *extra = m | (e != 0);
+        *mant = 0;
+    } else if (shift < 128) {
+        *extra = (m >> (shift - 64)) | (((m << (128 - shift)) | e) != 0);
+        *mant = 0;
+    } else {
+        *extra = (m | e) != 0;
+        *mant = 0;
+    }
+}
+
+unsigned long long f80_round(unsigned long long mant, unsigned long long extra, bool sign, __uint8_t rc, bool *inexact) { // extra = fraction below mant
+    if (!extra) {
+        return mant;
+    }
+    *inexact = true;
+
+    switch (rc) {
+        case FPU_RC_NEAREST: return mant + (extra > F80_J || (extra == F80_J && (mant & 1)));
+        case FPU_RC_DOWN: return mant + sign;
+        case FPU_RC_UP: return mant + !sign;
+        default: return mant;
+    }
+}
+
+float80_t f80_overflow(cpu_state_t *cpu, bool sign) {
+    __uint8_t rc = fpu_rc(cpu);
+    bool to_inf = rc == FPU_RC_NEAREST || (rc == FPU_RC_DOWN && sign) || (rc == FPU_RC_UP && !sign);
+
+    fpu_raise(cpu, FPU_OE | FPU_PE);
+    return to_inf ? f80_make(sign, 0x7FFF, F80_J) : f80_make(sign, 0x7FFE, ~0ULL);
+}
+
+float80_t f80_round_pack(cpu_state_t *cpu, bool sign, int exp, unsigned long long mant, unsigned long long extra) { // mant normalized
+    bool inexact = false;
+    bool tiny = exp <= 0;
+
+    if (tiny) { // Denormalize to the fixed scale of exponent field 0
+        f80_shift_right_jam(&mant, &extra, 1 - exp);
+        exp = 0;
+    }
+
+    unsigned long long r = f80_round(mant, extra, sign, fpu_rc(cpu), &inexact);
+    if (mant && !r) { // Carry out of bit 63
+        r = F80_J;
+        exp++;
+    } else if (exp == 0 && (r & F80_J)) { // Denormal rounded up to the smallest normal
+        exp = 1;
+    }
+
+    if (exp >= 0x7FFF) {
+        return f80_overflow(cpu, sign);
+    }
+    if (inexact) {
+        fpu_raise(cpu, tiny ? FPU_PE | FPU_UE : FPU_PE);
+    }
+
+    return f80_make(sign, exp, r);
+}
+
+float80_t f80_pack_parts(cpu_state_t *cpu, f80_parts_t p) {
+    return p.cls == F80_ZERO ? f80_make(p.sign, 0, 0) : f80_round_pack(cpu, p.sign, p.exp, p.mant, 0);
+}
+
+float80_t f80_propagate_nan(cpu_state_t *cpu, float80_t a, float80_t b) { // At least one operand is NaN or invalid
+    f80_parts_t pa = f80_unpack(a), pb = f80_unpack(b);
+
+    if (pa.cls == F80_INVALID || pb.cls == F80_INVALID) {
+        fpu_raise(cpu, FPU_IE);
+        return f80_indefinite;
+    }
+    if ((pa.cls == F80_NAN && !(pa.mant & F80_QUIET)) || (pb.cls == F80_NAN && !(pb.mant & F80_QUIET))) {
+        fpu_raise(cpu, FPU_IE);
+    }
+
+    float80_t r = (pa.cls != F80_NAN) ? b : (pb.cls != F80_NAN) ? a : ((a.mantissa << 1) >= (b.mantissa << 1) ? a : b);
+    r.mantissa |= F80_QUIET;
+    return r;
+}
+
+bool f80_is_nan(f80_parts_t p) {
+    return p.cls == F80_NAN || p.cls == F80_INVALID;
+}
+
+float80_t f80_add(cpu_state_t *cpu, float80_t a, float80_t b, bool subtract) {
+    f80_parts_t pa = f80_unpack(a), pb = f80_unpack(b);
+
+    if (f80_is_nan(pa) || f80_is_nan(pb)) {
+        return f80_propagate_nan(cpu, a, b);
+    }
+    pb.sign ^= subtract;
+
+    if (pa.cls == F80_INF || pb.cls == F80_INF) {
+        if (pa.cls == F80_INF && pb.cls == F80_INF && pa.sign != pb.sign) {
+            fpu_raise(cpu, FPU_IE);
+            return f80_indefinite;
+        }
+        return f80_make(pa.cls == F80_INF ? pa.sign : pb.sign, 0x7FFF, F80_J);
+    }
+    if (pa.cls == F80_ZERO && pb.cls == F80_ZERO) {
+        bool sign = (pa.sign == pb.sign) ? pa.sign : fpu_rc(cpu) == FPU_RC_DOWN;
+        return f80_make(sign, 0, 0);
+    }
+    if (pa.cls == F80_ZERO) {
+        return f80_pack_parts(cpu, pb);
+    }
+    if (pb.cls == F80_ZERO) {
+        return f80_pack_parts(cpu, pa);
+    }
+
+    if (pa.exp < pb.exp || (pa.exp == pb.exp && pa.mant < pb.mant)) { // |a| >= |b| from here on
+        f80_parts_t t = pa;
+        pa = pb;
+        pb = t;
+    }
+
+    unsigned long long hi = pa.mant, lo = 0;
+    unsigned long long b_hi = pb.mant, b_lo = 0;
+    f80_shift_right_jam(&b_hi, &b_lo, pa.exp - pb.exp);
+    int exp = pa.exp;
+
+    if (pa.sign == pb.sign) {
+        lo += b_lo;
+        unsigned long long carry = lo < b_lo;
+        hi += b_hi + carry;
+        if (hi < pa.mant || (carry && hi == pa.mant)) { // Carry out of bit 63
+            f80_shift_right_jam(&hi, &lo, 1);
+            hi |= F80_J;
+            exp++;
+        }
+    } else {
+        unsigned long long borrow = lo < b_lo;
+        lo -= b_lo;
+        hi -= b_hi + borrow;
+        if (!hi && !lo) {
+            return f80_make(fpu_rc(cpu) == FPU_RC_DOWN, 0, 0);
+        }
+        while (!(hi & F80_J)) {
+            hi = (hi << 1) | (lo >> 63);
+            lo <<= 1;
+            exp--;
+        }
+    }
+
+    return f80_round_pack(cpu, pa.sign, exp, hi, lo);
+}
+
+void f80_mul64(unsigned long long a, unsigned long long b, unsigned long long *hi, unsigned long long *lo) {
+    unsigned long long a_lo = a & 0xFFFFFFFF, a_hi = a >> 32;
+    unsigned long long b_lo = b & 0xFFFFFFFF, b_hi = b >> 32;
+    unsigned long long p0 = a_lo * b_lo, p1 = a_lo * b_hi, p2 = a_hi * b_lo, p3 = a_hi * b_hi;
+    unsigned long long mid = (p0 >> 32) + (p1 & 0xFFFFFFFF) + (p2 & 0xFFFFFFFF);
+
+    *lo = (p0 & 0xFFFFFFFF) | (mid << 32);
+    *hi = p3 + (p1 >> 32) + (p2 >> 32) + (mid >> 32);
+}
+
+float80_t f80_mul(cpu_state_t *cpu, float80_t a, float80_t b) {
+    f80_parts_t pa = f80_unpack(a), pb = f80_unpack(b);
+    bool sign = pa.sign ^ pb.sign;
+
+    if (f80_is_nan(pa) || f80_is_nan(pb)) {
+        return f80_propagate_nan(cpu, a, b);
+    }
+    if (pa.cls == F80_INF || pb.cls == F80_INF) {
+        if (pa.cls == F80_ZERO || pb.cls == F80_ZERO) {
+            fpu_raise(cpu, FPU_IE);
+            return f80_indefinite;
+        }
+        return f80_make(sign, 0x7FFF, F80_J);
+    }
+    if (pa.cls == F80_ZERO || pb.cls == F80_ZERO) {
+        return f80_make(sign, 0, 0);
+    }
+
+    unsigned long long hi, lo;
+    f80_mul64(pa.mant, pb.mant, &hi, &lo);
+    int exp = pa.exp + pb.exp - F80_BIAS + 1;
+
+    if (!(hi & F80_J)) {
+        hi = (hi << 1) | (lo >> 63);
+        lo <<= 1;
+        exp--;
+    }
+
+    return f80_round_pack(cpu, sign, exp, hi, lo);
+}
+
+float80_t f80_div(cpu_state_t *cpu, float80_t a, float80_t b) {
+    f80_parts_t pa = f80_unpack(a), pb = f80_unpack(b);
+    bool sign = pa.sign ^ pb.sign;
+
+    if (f80_is_nan(pa) || f80_is_nan(pb)) {
+        return f80_propagate_nan(cpu, a, b);
+    }
+    if ((pa.cls == F80_INF && pb.cls == F80_INF) || (pa.cls == F80_ZERO && pb.cls == F80_ZERO)) {
+        fpu_raise(cpu, FPU_IE);
+        return f80_indefinite;
+    }
+    if (pa.cls == F80_INF) {
+        return f80_make(sign, 0x7FFF, F80_J);
+    }
+    if (pb.cls == F80_ZERO) {
+        fpu_raise(cpu, FPU_ZE);
+        return f80_make(sign, 0x7FFF, F80_J);
+    }
+    if (pa.cls == F80_ZERO || pb.cls == F80_INF) {
+        return f80_make(sign, 0, 0);
+    }
+
+    // Restoring division: 64 quotient bits in hi, the next 64 in lo, remainder jammed into lo bit 0
+    unsigned long long rem = pa.mant, hi = 0, lo = 0;
+    int exp = pa.exp - pb.exp + F80_BIAS;
+    int bits = 64;
+
+    if (rem >= pb.mant) {
+        rem -= pb.mant;
+        hi = 1;
+        bits = 63;
+    } else {
+        exp--;
+    }
+
+    for (int i = 0; i < bits + 64; i++) {
+        bool carry = rem >> 63;
+        rem <<= 1;
+        bool bit = carry || rem >= pb.mant;
+        if (bit) {
+            rem -= pb.mant;
+        }
+        if (i < bits) {
+            hi = (hi << 1) | bit;
+        } else {
+            lo = (lo << 1) | bit;
+        }
+    }
+    lo |= rem != 0;
+
+    return f80_round_pack(cpu, sign, exp, hi, lo);
+}
+
+typedef enum {
+    FPU_GREATER,
+    FPU_LESS,
+    FPU_EQUAL,
+    FPU_UNORDERED
+} fpu_compare_t;
+
+fpu_compare_t f80_compare(float80_t a, float80_t b) {
+    f80_parts_t pa = f80_unpack(a), pb = f80_unpack(b);
+
+    if (f80_is_nan(pa) || f80_is_nan(pb)) {
+        return FPU_UNORDERED;
+    }
+    if (pa.cls == F80_ZERO && pb.cls == F80_ZERO) {
+        return FPU_EQUAL;
+    }
+    if (pa.cls == F80_ZERO) {
+        return pb.sign ? FPU_GREATER : FPU_LESS;
+    }
+    if (pb.cls == F80_ZERO || pa.sign != pb.sign) {
+        return pa.sign ? FPU_LESS : FPU_GREATER;
+    }
+
+    int exp_a = pa.cls == F80_INF ? 0x8000 : pa.exp;
+    int exp_b = pb.cls == F80_INF ? 0x8000 : pb.exp;
+
+    if (exp_a == exp_b && pa.mant == pb.mant) {
+        return FPU_EQUAL;
+    }
+    bool smaller = exp_a < exp_b || (exp_a == exp_b && pa.mant < pb.mant);
+    return (smaller != pa.sign) ? FPU_LESS : FPU_GREATER;
+}
+
+float80_t f80_from_int(long long value) { // Always exact
+    if (value == 0) {
+        return f80_make(false, 0, 0);
+    }
+
+    bool sign = value < 0;
+    unsigned long long mant = sign ? 0 - (unsigned long long)value : (unsigned long long)value;
+    int exp = F80_BIAS + 63;
+
+    while (!(mant & F80_J)) {
+        mant <<= 1;
+        exp--;
+    }
+
+    return f80_make(sign, exp, mant);
+}
+
+long long f80_to_int(cpu_state_t *cpu, float80_t x, int bits) { // Rounds by RC; out of range gives the integer indefinite
+    long long indefinite = (long long)(~0ULL << (bits - 1));
+    f80_parts_t p = f80_unpack(x);
+
+    if (p.cls == F80_ZERO) {
+        return 0;
+    }
+    if (p.cls != F80_FINITE || p.exp - F80_BIAS > 63) {
+        fpu_raise(cpu, FPU_IE);
+        return indefinite;
+    }
+
+    unsigned long long mant = p.mant, extra = 0;
+    bool inexact = false;
+    f80_shift_right_jam(&mant, &extra, 63 - (p.exp - F80_BIAS));
+    unsigned long long r = f80_round(mant, extra, p.sign, fpu_rc(cpu), &inexact);
+
+    unsigned long long limit = 1ULL << (bits - 1);
+    if (p.sign ? r > limit : r >= limit) {
+        fpu_raise(cpu, FPU_IE);
+        return indefinite;
+    }
+    if (inexact) {
+        fpu_raise(cpu, FPU_PE);
+    }
+
+    return p.sign ? (long long)(0 - r) : (long long)r;
+}
+
+float80_t f80_from_ieee(cpu_state_t *cpu, unsigned long long bits, int frac_bits, int exp_bits) { // float/double to 80-bit, exact
+    int bias = (1 << (exp_bits - 1)) - 1;
+    int emax = (1 << exp_bits) - 1;
+    bool sign = (bits >> (frac_bits + exp_bits)) & 1;
+    int exp = (bits >> frac_bits) & emax;
+    unsigned long long frac = bits & ((1ULL << frac_bits) - 1);
+    unsigned long long mant = frac << (63 - frac_bits);
+
+    if (exp == emax) {
+        if (frac && !(mant & F80_QUIET)) {
+            fpu_raise(cpu, FPU_IE); // Signaling NaN, loaded quiet
+            mant |= F80_QUIET;
+        }
+        return f80_make(sign, 0x7FFF, F80_J | mant);
+    }
+    if (exp == 0) {
+        if (!frac) {
+            return f80_make(sign, 0, 0);
+        }
+        fpu_raise(cpu, FPU_DE);
+        exp = 1 - bias + F80_BIAS;
+        while (!(mant & F80_J)) {
+            mant <<= 1;
+            exp--;
+        }
+        return f80_make(sign, exp, mant);
+    }
+
+    return f80_make(sign, exp - bias + F80_BIAS, F80_J | mant);
+}
+
+unsigned long long f80_to_ieee(cpu_state_t *cpu, float80_t x, int frac_bits, int exp_bits) { // 80-bit to float/double, rounds by RC
+    int bias = (1 << (exp_bits - 1)) - 1;
+    int emax = (1 << exp_bits) - 1;
+    unsigned long long frac_mask = (1ULL << frac_bits) - 1;
+    f80_parts_t p = f80_unpack(x);
+    unsigned long long sign = (unsigned long long)p.sign << (frac_bits + exp_bits);
+    unsigned long long inf = (unsigned long long)emax << frac_bits;
+    unsigned long long quiet = 1ULL << (frac_bits - 1);
+
+    switch (p.cls) {
+        case F80_INVALID:
+            fpu_raise(cpu, FPU_IE);
+            return (1ULL << (frac_bits + exp_bits)) | inf | quiet;
+        case F80_NAN:
+            if (!(p.mant & F80_QUIET)) {
+                fpu_raise(cpu, FPU_IE);
+            }
+            return sign | inf | quiet | ((p.mant >> (63 - frac_bits)) & frac_mask);
+        case F80_INF:
+            return sign | inf;
+        case F80_ZERO:
+            return sign;
+        default:
+            break;
+    }
+
+    int exp = p.exp - F80_BIAS + bias;
+    unsigned long long mant = p.mant, extra = 0;
+    bool inexact = false;
+
+    f80_shift_right_jam(&mant, &extra, exp >= 1 ? 63 - frac_bits : 63 - frac_bits + 1 - exp);
+    unsigned long long r = f80_round(mant, extra, p.sign, fpu_rc(cpu), &inexact);
+
+    if (exp >= 1) {
+        if (r >> (frac_bits + 1)) { // Rounded up to the next binade
+            r >>= 1;
+            exp++;
+        }
+        if (exp >= emax) {
+            __uint8_t rc = fpu_rc(cpu);
+            bool to_inf = rc == FPU_RC_NEAREST || (rc == FPU_RC_DOWN && p.sign) || (rc == FPU_RC_UP && !p.sign);
+            fpu_raise(cpu, FPU_OE | FPU_PE);
+            return sign | (to_inf ? inf : (inf - (1ULL << frac_bits)) | frac_mask);
+        }
+        r = ((unsigned long long)exp << frac_bits) | (r & frac_mask);
+    } else if (inexact) {
+        fpu_raise(cpu, FPU_UE); // r carries into the exponent field by itself if it rounds up to normal
+    }
+
+    if (inexact) {
+        fpu_raise(cpu, FPU_PE);
+    }
+
+    return sign | r;
+}
+
+// ---- Host double helpers (FPU_FAST) ----
+
+unsigned long long fpu_double_bits(double d) {
+    unsigned long long bits;
+    memcpy(&bits, &d, sizeof(bits));
+    return bits;
+}
+
+double fpu_bits_double(unsigned long long bits) {
+    double d;
+    memcpy(&d, &bits, sizeof(d));
+    return d;
+}
+
+double fpu_round_double(double x, __uint8_t rc) { // Round to an integer by RC without libm
+    if (!(x > -4503599627370496.0 && x < 4503599627370496.0)) {
+        return x; // Already integral (|x| >= 2^52), or NaN
+    }
+
+    double t = (double)(long long)x; // Toward zero
+    double frac = x - t;
+    bool odd = (long long)t & 1;
+
+    switch (rc) {
+        case FPU_RC_NEAREST:
+            if (frac > 0.5 || (frac == 0.5 && odd)) t += 1;
+            if (frac < -0.5 || (frac == -0.5 && odd)) t -= 1;
+            break;
+        case FPU_RC_DOWN:
+            if (frac < 0) t -= 1;
+            break;
+        case FPU_RC_UP:
+            if (frac > 0) t += 1;
+            break;
+    }
+
+    return t;
+}
+
+// ---- Register stack ----
+
+__uint8_t fpu_top(cpu_state_t *cpu) {
+    return (cpu->fpu.status >> 11) & 7;
+}
+
+void fpu_set_top(cpu_state_t *cpu, __uint8_t top) {
+    cpu->fpu.status = (cpu->fpu.status & ~0x3800) | ((top & 7) << 11);
+}
+
+bool fpu_empty(cpu_state_t *cpu, __uint8_t phys) {
+    return ((cpu->fpu.tag >> (phys * 2)) & 3) == 3;
+}
+
+void fpu_set_tag(cpu_state_t *cpu, __uint8_t phys, bool empty) { // Valid or empty; zero/special tags are not tracked
+    cpu->fpu.tag = (cpu->fpu.tag & ~(3 << (phys * 2))) | ((empty ? 3 : 0) << (phys * 2));
+}
+
+void fpu_init(cpu_state_t *cpu, fpu_precision_t precision) { // FNINIT state
+    memset(&cpu->fpu, 0, sizeof(cpu->fpu));
+    cpu->fpu.control = 0x037F; // All exceptions masked, 64-bit precision, round to nearest
+    cpu->fpu.status = 0;
+    cpu->fpu.tag = 0xFFFF;
+    cpu->fpu.precision = precision;
+}
+
+fpu_value_t fpu_indefinite(cpu_state_t *cpu) {
+    fpu_value_t v;
+    if (cpu->fpu.precision == FPU_FAST) {
+        v.d = fpu_bits_double(0xFFF8000000000000ULL);
+    } else {
+        v.x = f80_indefinite;
+    }
+    return v;
+}
+
+fpu_value_t fpu_get(cpu_state_t *cpu, __uint8_t i) { // ST(i)
+    __uint8_t phys = (fpu_top(cpu) + i) & 7;
+
+    if (fpu_empty(cpu, phys)) {
+        cpu->fpu.status &= ~FPU_C1;
+        fpu_raise(cpu, FPU_IE | FPU_SF); // Stack underflow
+        return fpu_indefinite(cpu);
+    }
+
+    return cpu->fpu.st[phys];
+}
+
+void fpu_set(cpu_state_t *cpu, __uint8_t i, fpu_value_t v) { // ST(i) = v
+    __uint8_t phys = (fpu_top(cpu) + i) & 7;
+    cpu->fpu.st[phys] = v;
+    fpu_set_tag(cpu, phys, false);
+}
+
+void fpu_push(cpu_state_t *cpu, fpu_value_t v) {
+    __uint8_t top = (fpu_top(cpu) - 1) & 7;
+
+    if (!fpu_empty(cpu, top)) {
+        cpu->fpu.status |= FPU_C1;
+        fpu_raise(cpu, FPU_IE | FPU_SF); // Stack overflow
+        v = fpu_indefinite(cpu);
+    }
+
+    fpu_set_top(cpu, top);
+    fpu_set(cpu, 0, v);
+}
+
+void fpu_pop(cpu_state_t *cpu) {
+    __uint8_t top = fpu_top(cpu);
+    fpu_set_tag(cpu, top, true);
+    fpu_set_top(cpu, top + 1);
+}
+
+// ---- Format conversions in the current precision mode ----
+
+fpu_value_t fpu_from_f80(cpu_state_t *cpu, float80_t x) {
+    fpu_value_t v;
+    if (cpu->fpu.precision == FPU_FAST) {
+        v.d = fpu_bits_double(f80_to_ieee(cpu, x, 52, 11));
+    } else {
+        v.x = x;
+    }
+    return v;
+}
+
+float80_t fpu_to_f80(cpu_state_t *cpu, fpu_value_t v) {
+    return cpu->fpu.precision == FPU_FAST ? f80_from_ieee(cpu, fpu_double_bits(v.d), 52, 11) : v.x;
+}
+
+fpu_value_t fpu_from_m32(cpu_state_t *cpu, __uint32_t bits) {
+    fpu_value_t v;
+    if (cpu->fpu.precision == FPU_FAST) {
+        float f;
+        memcpy(&f, &bits, sizeof(f));
+        v.d = f;
+    } else {
+        v.x = f80_from_ieee(cpu, bits, 23, 8);
+    }
+    return v;
+}
+
+fpu_value_t fpu_from_m64(cpu_state_t *cpu, unsigned long long bits) {
+    fpu_value_t v;
+    if (cpu->fpu.precision == FPU_FAST) {
+        v.d = fpu_bits_double(bits);
+    } else {
+        v.x = f80_from_ieee(cpu, bits, 52, 11);
+    }
+    return v;
+}
+
+fpu_value_t fpu_from_int(cpu_state_t *cpu, long long value) {
+    fpu_value_t v;
+    if (cpu->fpu.precision == FPU_FAST) {
+        v.d = (double)value;
+    } else {
+        v.x = f80_from_int(value);
+    }
+    return v;
+}
+
+__uint32_t fpu_to_m32(cpu_state_t *cpu, fpu_value_t v) {
+    if (cpu->fpu.precision == FPU_FAST) {
+        float f = (float)v.d;
+        __uint32_t bits;
+        memcpy(&bits, &f, sizeof(bits));
+        return bits;
+    }
+    return f80_to_ieee(cpu, v.x, 23, 8);
+}
+
+unsigned long long fpu_to_m64(cpu_state_t *cpu, fpu_value_t v) {
+    return cpu->fpu.precision == FPU_FAST ? fpu_double_bits(v.d) : f80_to_ieee(cpu, v.x, 52, 11);
+}
+
+long long fpu_to_int(cpu_state_t *cpu, fpu_value_t v, int bits) {
+    if (cpu->fpu.precision == FPU_EXACT) {
+        return f80_to_int(cpu, v.x, bits);
+    }
+
+    long long indefinite = (long long)(~0ULL << (bits - 1));
+    double limit = (double)(1ULL << (bits - 1));
+    double r = fpu_round_double(v.d, fpu_rc(cpu));
+
+    if (!(r >= -limit && r < limit)) { // Also catches NaN
+        fpu_raise(cpu, FPU_IE);
+        return indefinite;
+    }
+    if (r != v.d) {
+        fpu_raise(cpu, FPU_PE);
+    }
+
+    return (long long)r;
+}
+
+// ---- Arithmetic and compare ----
+
+fpu_value_t fpu_arith(cpu_state_t *cpu, fpu_op_t op, fpu_value_t a, fpu_value_t b) { // a op b
+    fpu_value_t r;
+
+    if (cpu->fpu.precision == FPU_EXACT) {
+        switch (op) {
+            case FPU_ADD: r.x = f80_add(cpu, a.x, b.x, false); break;
+            case FPU_MUL: r.x = f80_mul(cpu, a.x, b.x); break;
+            case FPU_SUB: r.x = f80_add(cpu, a.x, b.x, true); break;
+            case FPU_SUBR: r.x = f80_add(cpu, b.x, a.x, true); break;
+            case FPU_DIV: r.x = f80_div(cpu, a.x, b.x); break;
+            case FPU_DIVR: r.x = f80_div(cpu, b.x, a.x); break;
+            default: abort();
+        }
+        return r;
+    }
+
+    double x = a.d, y = b.d;
+
+    switch (op) {
+        case FPU_ADD: r.d = x + y; break;
+        case FPU_MUL: r.d = x * y; break;
+        case FPU_SUB: r.d = x - y; break;
+        case FPU_SUBR: r.d = y - x; break;
+        case FPU_DIV: r.d = x / y; break;
+        case FPU_DIVR: r.d = y / x; break;
+        default: abort();
+    }
+
+    if (r.d != r.d && x == x && y == y) {
+        fpu_raise(cpu, FPU_IE);
+    } else if ((op == FPU_DIV || op == FPU_DIVR)) {
+        double dividend = (op == FPU_DIV) ? x : y, divisor = (op == FPU_DIV) ? y : x;
+        if (divisor == 0 && dividend != 0 && dividend - dividend == 0) { // Finite non-zero / 0
+            fpu_raise(cpu, FPU_ZE);
+        }
+    }
+
+    return r;
+}
+
+void fpu_compare(cpu_state_t *cpu, fpu_value_t a, fpu_value_t b, bool unordered) { // Sets C3/C2/C0; FUCOM passes unordered = true
+    fpu_compare_t result;
+    bool signaling;
+
+    if (cpu->fpu.precision == FPU_EXACT) {
+        result = f80_compare(a.x, b.x);
+        f80_parts_t pa = f80_unpack(a.x), pb = f80_unpack(b.x);
+        signaling = pa.cls == F80_INVALID || pb.cls == F80_INVALID ||
+                    (pa.cls == F80_NAN && !(pa.mant & F80_QUIET)) || (pb.cls == F80_NAN && !(pb.mant & F80_QUIET));
+    } else {
+        result = a.d > b.d ? FPU_GREATER : a.d < b.d ? FPU_LESS : a.d == b.d ? FPU_EQUAL : FPU_UNORDERED;
+        unsigned long long qa = fpu_double_bits(a.d), qb = fpu_double_bits(b.d);
+        signaling = (a.d != a.d && !(qa & (1ULL << 51))) || (b.d != b.d && !(qb & (1ULL << 51)));
+    }
+
+    if (result == FPU_UNORDERED && (!unordered || signaling)) {
+        fpu_raise(cpu, FPU_IE);
+    }
+
+    cpu->fpu.status &= ~(FPU_C0 | FPU_C1 | FPU_C2 | FPU_C3);
+    switch (result) {
+        case FPU_GREATER: break;
+        case FPU_LESS: cpu->fpu.status |= FPU_C0; break;
+        case FPU_EQUAL: cpu->fpu.status |= FPU_C3; break;
+        case FPU_UNORDERED: cpu->fpu.status |= FPU_C0 | FPU_C2 | FPU_C3; break;
+    }
+}
+
+void fpu_op_st0(cpu_state_t *cpu, fpu_op_t op, fpu_value_t src) { // ST(0) = ST(0) op src, or compare for FCOM/FCOMP
+    fpu_value_t st0 = fpu_get(cpu, 0);
+
+    if (op == FPU_COM || op == FPU_COMP) {
+        fpu_compare(cpu, st0, src, false);
+        if (op == FPU_COMP) {
+            fpu_pop(cpu);
+        }
+        return;
+    }
+
+    fpu_set(cpu, 0, fpu_arith(cpu, op, st0, src));
+}
+
+void fpu_op_sti(cpu_state_t *cpu, fpu_op_t op, __uint8_t i, bool pop) { // ST(i) = ST(i) op ST(0)
+    fpu_set(cpu, i, fpu_arith(cpu, op, fpu_get(cpu, i), fpu_get(cpu, 0)));
+
+    if (pop) {
+        fpu_pop(cpu);
+    }
+}
+
+fpu_value_t fpu_constant(cpu_state_t *cpu, __uint8_t rm) { // FLD1, FLDL2T, FLDL2E, FLDPI, FLDLG2, FLDLN2, FLDZ (D9 E8+rm)
+    // Mantissas truncated to 64 bits plus the next 8 bits, rounded by RC like the
+    // hardware does; constant loads never raise exceptions
+    static const float80_t constants[7] = {
+        { 0x8000000000000000ULL, 0x3FFF }, // 1
+        { 0xD49A784BCD1B8AFEULL, 0x4000 }, // log2(10)
+        { 0xB8AA3B295C17F0BBULL, 0x3FFF }, // log2(e)
+        { 0xC90FDAA22168C234ULL, 0x4000 }, // pi
+        { 0x9A209A84FBCFF798ULL, 0x3FFD }, // log10(2)
+        { 0xB17217F7D1CF79ABULL, 0x3FFE }, // ln(2)
+        { 0x0000000000000000ULL, 0x0000 }  // +0
+    };
+    static const __uint8_t tails[7] = { 0x00, 0x49, 0xBE, 0xC4, 0x8F, 0xC9, 0x00 };
+    static const double doubles[7] = { // FPU_FAST, nearest
+        1.0, 3.32192809488736234787, 1.44269504088896340736, 3.14159265358979323846,
+        0.30102999566398119521, 0.69314718055994530942, 0.0
+    };
+    fpu_value_t v;
+
+    if (cpu->fpu.precision == FPU_FAST) {
+        v.d = doubles[rm];
+        return v;
+    }
+
+    v.x = constants[rm];
+    __uint8_t rc = fpu_rc(cpu);
+    if ((rc == FPU_RC_NEAREST && tails[rm] >= 0x80) || (rc == FPU_RC_UP && tails[rm] != 0)) {
+        v.x.mantissa++; // All positive and none all-ones, so no carry out
+    }
+    return v;
+}
+
+unsigned long long fpu_checksum(cpu_state_t *cpu, unsigned long long h) { // Folds the FPU state into an FNV-1a hash
+    unsigned long long words[19];
+    int n = 0;
+
+    for (int i = 0; i < 8; i++) {
+        if (cpu->fpu.precision == FPU_FAST) {
+            words[n++] = fpu_double_bits(cpu->fpu.st[i].d);
+        } else {
+            words[n++] = cpu->fpu.st[i].x.mantissa;
+            words[n++] = cpu->fpu.st[i].x.sign_exp;
+        }
+    }
+    words[n++] = cpu->fpu.control;
+    words[n++] = cpu->fpu.status;
+    words[n++] = cpu->fpu.tag;
+
+    return fnv1a(h, words, n * sizeof(words[0]));
+}
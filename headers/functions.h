@@ -1,4 +1,6 @@
 #include "tools.h"
+#include "replay.h"
+#include "fpu.h"
 
 typedef void (*Opcodes)(cpu_state_t*, __uint8_t opcode);
 
@@ -90,6 +92,10 @@ void mov_r16or32_rm16or32(cpu_state_t *cpu, __uint8_t opcode) { // MOV r16, r/m1
 
 void mov_rm16_sreg(cpu_state_t *cpu, __uint8_t opcode) { // MOV r/m16, Sreg
     modrm_t m = decode_modrm(cpu);
+    if (m.reg > 5) {
+        unsupported(cpu, "#UD Exception, while not released\n");
+        return;
+    }
 
     __uint16_t *src = get_sreg(cpu, m.reg);
 
@@ -106,10 +112,9 @@ void mov_rm16_sreg(cpu_state_t *cpu, __uint8_t opcode) { // MOV r/m16, Sreg
 
 void mov_sreg_rm16(cpu_state_t *cpu, __uint8_t opcode) { // MOV Sreg, r/m16
     modrm_t m = decode_modrm(cpu);
-    if (m.reg == 1) {
-        fprintf(stderr, "#UD Exception, while not released");
-        abort();
-        // #UD
+    if (m.reg == 1 || m.reg > 5) {
+        unsupported(cpu, "#UD Exception, while not released\n");
+        return;
     }
 
     __uint16_t *dst = get_sreg(cpu, m.reg);
@@ -128,15 +133,7 @@ void mov_sreg_rm16(cpu_state_t *cpu, __uint8_t opcode) { // MOV Sreg, r/m16
 void mov_al_moffs8(cpu_state_t *cpu, __uint8_t opcode) { // MOV AL, moffs8
     bool addr32 = (cpu->mode != REAL_MODE) || cpu->prefix.x67_mode;
 
-    __uint32_t offset;
-
-    if (addr32) {
-        offset = read_double_word(cpu, cpu->seg.cs.dword, cpu->eip.dword);
-        cpu->eip.dword += 4;
-    } else {
-        offset = read_word(cpu, cpu->seg.cs.dword, cpu->eip.dword);
-        cpu->eip.dword += 2;
-    }
+    __uint32_t offset = fetch_immediate(cpu, addr32 ? 4 : 2);
 
     __uint8_t value = read_byte(cpu, cpu->seg.cs.dword, offset);
 
@@ -148,15 +145,7 @@ void mov_axoreax_moffs16or32(cpu_state_t *cpu, __uint8_t opcode) { // MOV AX/EAX
     bool op32 = (cpu->mode != REAL_MODE && !cpu->prefix.x66_mode) || (cpu->mode == REAL_MODE && cpu->prefix.x66_mode);
     bool addr32 = (cpu->mode != REAL_MODE) || cpu->prefix.x67_mode;
 
-    __uint32_t offset;
-
-    if (addr32) {
-        offset = read_double_word(cpu, cpu->seg.cs.dword, cpu->eip.dword);
-        cpu->eip.dword += 4;
-    } else {
-        offset = read_word(cpu, cpu->seg.cs.dword, cpu->eip.dword);
-        cpu->eip.dword += 2;
-    }
+    __uint32_t offset = fetch_immediate(cpu, addr32 ? 4 : 2);
 
     if (op32) {
         cpu->gpr.eax.dword = read_double_word(cpu, cpu->seg.ds.dword, offset);
@@ -170,15 +159,7 @@ void mov_axoreax_moffs16or32(cpu_state_t *cpu, __uint8_t opcode) { // MOV AX/EAX
 void mov_moffs8_al(cpu_state_t *cpu, __uint8_t opcode) { // MOV moffs8, AL
     bool addr32 = (cpu->mode != REAL_MODE) || cpu->prefix.x67_mode;
 
-    __uint32_t offset;
-
-    if (addr32) {
-        offset = read_double_word(cpu, cpu->seg.cs.dword, cpu->eip.dword);
-        cpu->eip.dword += 4;
-    } else {
-        offset = read_word(cpu, cpu->seg.cs.dword, cpu->eip.dword);
-        cpu->eip.dword += 2;
-    }
+    __uint32_t offset = fetch_immediate(cpu, addr32 ? 4 : 2);
 
     __uint8_t value = cpu->gpr.eax.dword & 0xFF;
     write_byte(cpu, cpu->seg.ds.dword, offset, value);
@@ -188,15 +169,7 @@ void mov_moffs16or32_axoreax(cpu_state_t *cpu, __uint8_t opcode) { // moffs16/32
     bool op32 = (cpu->mode != REAL_MODE && !cpu->prefix.x66_mode) || (cpu->mode == REAL_MODE && cpu->prefix.x66_mode);
     bool addr32 = (cpu->mode != REAL_MODE) || cpu->prefix.x67_mode;
 
-    __uint32_t offset;
-
-    if (addr32) {
-        offset = read_double_word(cpu, cpu->seg.cs.dword, cpu->eip.dword);
-        cpu->eip.dword += 4;
-    } else {
-        offset = read_word(cpu, cpu->seg.cs.dword, cpu->eip.dword);
-        cpu->eip.dword += 2;
-    }
+    __uint32_t offset = fetch_immediate(cpu, addr32 ? 4 : 2);
 
     if (op32) {
         __uint32_t value = cpu->gpr.eax.dword;
@@ -211,7 +184,7 @@ void mov_reg8_imm8(cpu_state_t *cpu, __uint8_t opcode) { // MOV reg8, imm8
     __uint8_t reg = opcode & 0x07;
     __uint8_t* dst = get_reg8(cpu, reg);
 
-    __uint8_t imm = read_byte(cpu, cpu->seg.cs.dword, cpu->eip.dword++);
+    __uint8_t imm = fetch_immediate(cpu, 1);
 
     *dst = imm;
 }
@@ -223,15 +196,13 @@ void mov_reg16or32_imm16or32(cpu_state_t *cpu, __uint8_t opcode) { // MOV reg16/
     if (op32) {
         __uint32_t* dst = get_reg32(cpu, reg);
 
-        __uint32_t imm = read_double_word(cpu, cpu->seg.cs.dword, cpu->eip.dword);
-        cpu->eip.dword += 4;
+        __uint32_t imm = fetch_immediate(cpu, 4);
 
         *dst = imm;
     } else {
        __uint16_t* dst = get_reg16(cpu, reg);
 
-        __uint16_t imm = read_word(cpu, cpu->seg.cs.dword, cpu->eip.dword);
-        cpu->eip.dword += 2;
+        __uint16_t imm = fetch_immediate(cpu, 2);
 
         *dst = imm;
     }
@@ -241,12 +212,11 @@ void mov_rm8_imm8(cpu_state_t *cpu, __uint8_t opcode) { // MOV r/m8, imm8
     modrm_t m = decode_modrm(cpu);
 
     if (m.reg != 0) {
-        fprintf(stderr, "#UD Exception, while not released");
-        abort();
-        // #UD
+        unsupported(cpu, "#UD Exception, while not released\n");
+        return;
     }
 
-    __uint8_t imm = read_byte(cpu, cpu->seg.cs.dword, cpu->eip.dword++);
+    __uint8_t imm = fetch_immediate(cpu, 1);
 
     if (m.mod == 3) {
         __uint8_t *dst = get_reg8(cpu, m.rm);
@@ -263,22 +233,19 @@ void mov_rm16or32_imm16or32(cpu_state_t *cpu, __uint8_t opcode) { // MOV r/m16/3
     modrm_t m = decode_modrm(cpu);
 
     if (m.reg != 0) {
-        fprintf(stderr, "#UD Exception, while not released");
-        abort();
-        // #UD
+        unsupported(cpu, "#UD Exception, while not released\n");
+        return;
     }
 
     bool op32 = (cpu->mode != REAL_MODE && !cpu->prefix.x66_mode) || (cpu->mode == REAL_MODE && cpu->prefix.x66_mode);
 
     if (m.mod == 3) {
         if (op32) {
-            __uint32_t imm = read_double_word(cpu, cpu->seg.cs.dword, cpu->eip.dword);
-            cpu->eip.dword += 4;
+            __uint32_t imm = fetch_immediate(cpu, 4);
             __uint32_t *dst = get_reg32(cpu, m.rm);
             *dst = imm;
         } else {
-            __uint16_t imm = read_word(cpu, cpu->seg.cs.dword, cpu->eip.dword);
-            cpu->eip.dword += 2;
+            __uint16_t imm = fetch_immediate(cpu, 2);
             __uint16_t *dst = get_reg16(cpu, m.rm);
             *dst = imm;
         }
@@ -287,13 +254,11 @@ void mov_rm16or32_imm16or32(cpu_state_t *cpu, __uint8_t opcode) { // MOV r/m16/3
         __uint32_t ea = effective_address(cpu, m, &out_segment);
 
         if (op32) {
-            __uint32_t imm = read_double_word(cpu, cpu->seg.cs.dword, cpu->eip.dword);
-            cpu->eip.dword += 4;
+            __uint32_t imm = fetch_immediate(cpu, 4);
 
             write_double_word(cpu, out_segment, ea, imm);
         } else {
-            __uint16_t imm = read_word(cpu, cpu->seg.cs.dword, cpu->eip.dword);
-            cpu->eip.dword += 2;
+            __uint16_t imm = fetch_immediate(cpu, 2);
 
             write_word(cpu, out_segment, ea, imm);
         }
@@ -305,9 +270,8 @@ void push_m16or32(cpu_state_t *cpu, __uint8_t opcode) { // PUSH, m16/32
     modrm_t m = decode_modrm(cpu);
 
     if (m.reg != 6) {
-        fprintf(stderr, "#UD Exception, while not released");
-        abort();
-        // #UD
+        unsupported(cpu, "#UD Exception, while not released\n");
+        return;
     }
 
     if (m.mod == 3) {
@@ -332,6 +296,269 @@ void push_m16or32(cpu_state_t *cpu, __uint8_t opcode) { // PUSH, m16/32
     }
 }
 
+void in_al_imm8(cpu_state_t *cpu, __uint8_t opcode) { // IN AL, imm8
+    __uint8_t port = fetch_immediate(cpu, 1);
+    cpu->gpr.eax.low8 = port_read(cpu, port, 1);
+}
+
+void in_axoreax_imm8(cpu_state_t *cpu, __uint8_t opcode) { // IN AX/EAX, imm8
+    bool op32 = (cpu->mode != REAL_MODE && !cpu->prefix.x66_mode) || (cpu->mode == REAL_MODE && cpu->prefix.x66_mode);
+    __uint8_t port = fetch_immediate(cpu, 1);
+
+    if (op32) {
+        cpu->gpr.eax.dword = port_read(cpu, port, 4);
+    } else {
+        cpu->gpr.eax.low16 = port_read(cpu, port, 2);
+    }
+}
+
+void in_al_dx(cpu_state_t *cpu, __uint8_t opcode) { // IN AL, DX
+    cpu->gpr.eax.low8 = port_read(cpu, cpu->gpr.edx.low16, 1);
+}
+
+void in_axoreax_dx(cpu_state_t *cpu, __uint8_t opcode) { // IN AX/EAX, DX
+    bool op32 = (cpu->mode != REAL_MODE && !cpu->prefix.x66_mode) || (cpu->mode == REAL_MODE && cpu->prefix.x66_mode);
+
+    if (op32) {
+        cpu->gpr.eax.dword = port_read(cpu, cpu->gpr.edx.low16, 4);
+    } else {
+        cpu->gpr.eax.low16 = port_read(cpu, cpu->gpr.edx.low16, 2);
+    }
+}
+
+void fpu_unsupported(cpu_state_t *cpu, modrm_t m, __uint8_t opcode) {
+    unsupported(cpu, "x87 opcode %02X /%u (mod %u, rm %u) not implemented\n", opcode, m.reg, m.mod, m.rm);
+}
+
+void fpu_d8(cpu_state_t *cpu, __uint8_t opcode) { // FADD/FMUL/FCOM/FCOMP/FSUB/FSUBR/FDIV/FDIVR m32real || ST(0), ST(i)
+    modrm_t m = decode_modrm(cpu);
+
+    if (m.mod == 3) {
+        fpu_op_st0(cpu, m.reg, fpu_get(cpu, m.rm));
+    } else {
+        __uint16_t out_segment;
+        __uint32_t ea = effective_address(cpu, m, &out_segment);
+
+        fpu_op_st0(cpu, m.reg, fpu_from_m32(cpu, read_double_word(cpu, out_segment, ea)));
+    }
+}
+
+void fpu_d9(cpu_state_t *cpu, __uint8_t opcode) { // FLD/FST/FSTP m32real, FLDCW, FNSTCW, FLD ST(i), FXCH, FCHS, FABS, FTST, FLDconst
+    modrm_t m = decode_modrm(cpu);
+
+    if (m.mod != 3) {
+        __uint16_t out_segment;
+        __uint32_t ea = effective_address(cpu, m, &out_segment);
+
+        switch (m.reg) {
+            case 0: fpu_push(cpu, fpu_from_m32(cpu, read_double_word(cpu, out_segment, ea))); break; // FLD m32real
+            case 2: write_double_word(cpu, out_segment, ea, fpu_to_m32(cpu, fpu_get(cpu, 0))); break; // FST m32real
+            case 3: write_double_word(cpu, out_segment, ea, fpu_to_m32(cpu, fpu_get(cpu, 0))); fpu_pop(cpu); break; // FSTP m32real
+            case 5: cpu->fpu.control = read_word(cpu, out_segment, ea); break; // FLDCW
+            case 7: write_word(cpu, out_segment, ea, cpu->fpu.control); break; // FNSTCW
+            default: fpu_unsupported(cpu, m, opcode); // FLDENV, FNSTENV
+        }
+        return;
+    }
+
+    switch (m.reg) {
+        case 0: fpu_push(cpu, fpu_get(cpu, m.rm)); break; // FLD ST(i)
+        case 1: { // FXCH ST(i)
+            fpu_value_t st0 = fpu_get(cpu, 0);
+            fpu_value_t sti = fpu_get(cpu, m.rm);
+            fpu_set(cpu, 0, sti);
+            fpu_set(cpu, m.rm, st0);
+            break;
+        }
+        case 2: // FNOP
+            if (m.rm != 0) { fpu_unsupported(cpu, m, opcode); return; }
+            break;
+        case 4: {
+            fpu_value_t st0 = fpu_get(cpu, 0);
+            switch (m.rm) {
+                case 0: // FCHS
+                    if (cpu->fpu.precision == FPU_FAST) st0.d = -st0.d; else st0.x.sign_exp ^= 0x8000;
+                    fpu_set(cpu, 0, st0);
+                    break;
+                case 1: // FABS
+                    if (cpu->fpu.precision == FPU_FAST) st0.d = fpu_bits_double(fpu_double_bits(st0.d) & ~(1ULL << 63)); else st0.x.sign_exp &= 0x7FFF;
+                    fpu_set(cpu, 0, st0);
+                    break;
+                case 4: // FTST
+                    fpu_compare(cpu, st0, fpu_from_int(cpu, 0), false);
+                    break;
+                default: fpu_unsupported(cpu, m, opcode); // FXAM
+            }
+            break;
+        }
+        case 5: // FLD1, FLDL2T, FLDL2E, FLDPI, FLDLG2, FLDLN2, FLDZ
+            if (m.rm == 7) { fpu_unsupported(cpu, m, opcode); return; }
+            fpu_push(cpu, fpu_constant(cpu, m.rm));
+            break;
+        case 6:
+            if (m.rm == 6) { fpu_set_top(cpu, fpu_top(cpu) - 1); cpu->fpu.status &= ~FPU_C1; break; } // FDECSTP
+            if (m.rm == 7) { fpu_set_top(cpu, fpu_top(cpu) + 1); cpu->fpu.status &= ~FPU_C1; break; } // FINCSTP
+            fpu_unsupported(cpu, m, opcode);
+            break;
+        default: fpu_unsupported(cpu, m, opcode); // Transcendentals, FSQRT, FRNDINT, ...
+    }
+}
+
+void fpu_da(cpu_state_t *cpu, __uint8_t opcode) { // FIADD/FIMUL/FICOM/FICOMP/FISUB/FISUBR/FIDIV/FIDIVR m32int, FUCOMPP
+    modrm_t m = decode_modrm(cpu);
+
+    if (m.mod == 3) {
+        if (m.reg != 5 || m.rm != 1) {
+            fpu_unsupported(cpu, m, opcode); // FCMOVcc
+            return;
+        }
+        fpu_compare(cpu, fpu_get(cpu, 0), fpu_get(cpu, 1), true); // FUCOMPP
+        fpu_pop(cpu);
+        fpu_pop(cpu);
+        return;
+    }
+
+    __uint16_t out_segment;
+    __uint32_t ea = effective_address(cpu, m, &out_segment);
+
+    fpu_op_st0(cpu, m.reg, fpu_from_int(cpu, (__int32_t)read_double_word(cpu, out_segment, ea)));
+}
+
+void fpu_db(cpu_state_t *cpu, __uint8_t opcode) { // FILD/FIST/FISTP m32int, FLD/FSTP m80real, FNCLEX, FNINIT
+    modrm_t m = decode_modrm(cpu);
+
+    if (m.mod == 3) {
+        if (m.reg == 4 && m.rm == 2) { // FNCLEX
+            cpu->fpu.status &= ~(FPU_B | FPU_ES | FPU_SF | 0x3F);
+        } else if (m.reg == 4 && m.rm == 3) { // FNINIT
+            fpu_init(cpu, cpu->fpu.precision);
+        } else {
+            fpu_unsupported(cpu, m, opcode);
+        }
+        return;
+    }
+
+    __uint16_t out_segment;
+    __uint32_t ea = effective_address(cpu, m, &out_segment);
+
+    switch (m.reg) {
+        case 0: fpu_push(cpu, fpu_from_int(cpu, (__int32_t)read_double_word(cpu, out_segment, ea))); break; // FILD m32int
+        case 2: write_double_word(cpu, out_segment, ea, fpu_to_int(cpu, fpu_get(cpu, 0), 32)); break; // FIST m32int
+        case 3: write_double_word(cpu, out_segment, ea, fpu_to_int(cpu, fpu_get(cpu, 0), 32)); fpu_pop(cpu); break; // FISTP m32int
+        case 5: { // FLD m80real
+            float80_t x;
+            x.mantissa = read_quad_word(cpu, out_segment, ea);
+            x.sign_exp = read_word(cpu, out_segment, ea + 8);
+            fpu_push(cpu, fpu_from_f80(cpu, x));
+            break;
+        }
+        case 7: { // FSTP m80real
+            float80_t x = fpu_to_f80(cpu, fpu_get(cpu, 0));
+            write_quad_word(cpu, out_segment, ea, x.mantissa);
+            write_word(cpu, out_segment, ea + 8, x.sign_exp);
+            fpu_pop(cpu);
+            break;
+        }
+        default: fpu_unsupported(cpu, m, opcode);
+    }
+}
+
+void fpu_dc(cpu_state_t *cpu, __uint8_t opcode) { // FADD/FMUL/FCOM/FCOMP/FSUB/FSUBR/FDIV/FDIVR m64real || ST(i), ST(0)
+    modrm_t m = decode_modrm(cpu);
+
+    if (m.mod == 3) {
+        if (m.reg == FPU_COM || m.reg == FPU_COMP) {
+            fpu_unsupported(cpu, m, opcode);
+            return;
+        }
+        // Register forms swap SUB/SUBR and DIV/DIVR: DC E8+i is FSUB ST(i), ST(0)
+        fpu_op_sti(cpu, m.reg >= 4 ? m.reg ^ 1 : m.reg, m.rm, false);
+    } else {
+        __uint16_t out_segment;
+        __uint32_t ea = effective_address(cpu, m, &out_segment);
+
+        fpu_op_st0(cpu, m.reg, fpu_from_m64(cpu, read_quad_word(cpu, out_segment, ea)));
+    }
+}
+
+void fpu_dd(cpu_state_t *cpu, __uint8_t opcode) { // FLD/FST/FSTP m64real, FNSTSW m16, FFREE, FST/FSTP ST(i), FUCOM/FUCOMP
+    modrm_t m = decode_modrm(cpu);
+
+    if (m.mod != 3) {
+        __uint16_t out_segment;
+        __uint32_t ea = effective_address(cpu, m, &out_segment);
+
+        switch (m.reg) {
+            case 0: fpu_push(cpu, fpu_from_m64(cpu, read_quad_word(cpu, out_segment, ea))); break; // FLD m64real
+            case 2: write_quad_word(cpu, out_segment, ea, fpu_to_m64(cpu, fpu_get(cpu, 0))); break; // FST m64real
+            case 3: write_quad_word(cpu, out_segment, ea, fpu_to_m64(cpu, fpu_get(cpu, 0))); fpu_pop(cpu); break; // FSTP m64real
+            case 7: write_word(cpu, out_segment, ea, cpu->fpu.status); break; // FNSTSW m16
+            default: fpu_unsupported(cpu, m, opcode); // FRSTOR, FNSAVE
+        }
+        return;
+    }
+
+    switch (m.reg) {
+        case 0: fpu_set_tag(cpu, (fpu_top(cpu) + m.rm) & 7, true); break; // FFREE ST(i)
+        case 2: fpu_set(cpu, m.rm, fpu_get(cpu, 0)); break; // FST ST(i)
+        case 3: fpu_set(cpu, m.rm, fpu_get(cpu, 0)); fpu_pop(cpu); break; // FSTP ST(i)
+        case 4: fpu_compare(cpu, fpu_get(cpu, 0), fpu_get(cpu, m.rm), true); break; // FUCOM ST(i)
+        case 5: fpu_compare(cpu, fpu_get(cpu, 0), fpu_get(cpu, m.rm), true); fpu_pop(cpu); break; // FUCOMP ST(i)
+        default: fpu_unsupported(cpu, m, opcode);
+    }
+}
+
+void fpu_de(cpu_state_t *cpu, __uint8_t opcode) { // FIADD..FIDIVR m16int || FADDP/FMULP/FSUBRP/FSUBP/FDIVRP/FDIVP ST(i), ST(0), FCOMPP
+    modrm_t m = decode_modrm(cpu);
+
+    if (m.mod == 3) {
+        if (m.reg == FPU_COMP && m.rm == 1) { // FCOMPP
+            fpu_compare(cpu, fpu_get(cpu, 0), fpu_get(cpu, 1), false);
+            fpu_pop(cpu);
+            fpu_pop(cpu);
+        } else if (m.reg == FPU_COM || m.reg == FPU_COMP) {
+            fpu_unsupported(cpu, m, opcode);
+        } else {
+            fpu_op_sti(cpu, m.reg >= 4 ? m.reg ^ 1 : m.reg, m.rm, true);
+        }
+        return;
+    }
+
+    __uint16_t out_segment;
+    __uint32_t ea = effective_address(cpu, m, &out_segment);
+
+    fpu_op_st0(cpu, m.reg, fpu_from_int(cpu, (__int16_t)read_word(cpu, out_segment, ea)));
+}
+
+void fpu_df(cpu_state_t *cpu, __uint8_t opcode) { // FILD/FIST/FISTP m16int, FILD/FISTP m64int, FNSTSW AX
+    modrm_t m = decode_modrm(cpu);
+
+    if (m.mod == 3) {
+        if (m.reg != 4 || m.rm != 0) {
+            fpu_unsupported(cpu, m, opcode);
+            return;
+        }
+        cpu->gpr.eax.low16 = cpu->fpu.status; // FNSTSW AX
+        return;
+    }
+
+    __uint16_t out_segment;
+    __uint32_t ea = effective_address(cpu, m, &out_segment);
+
+    switch (m.reg) {
+        case 0: fpu_push(cpu, fpu_from_int(cpu, (__int16_t)read_word(cpu, out_segment, ea))); break; // FILD m16int
+        case 2: write_word(cpu, out_segment, ea, fpu_to_int(cpu, fpu_get(cpu, 0), 16)); break; // FIST m16int
+        case 3: write_word(cpu, out_segment, ea, fpu_to_int(cpu, fpu_get(cpu, 0), 16)); fpu_pop(cpu); break; // FISTP m16int
+        case 5: fpu_push(cpu, fpu_from_int(cpu, (long long)read_quad_word(cpu, out_segment, ea))); break; // FILD m64int
+        case 7: write_quad_word(cpu, out_segment, ea, fpu_to_int(cpu, fpu_get(cpu, 0), 64)); fpu_pop(cpu); break; // FISTP m64int
+        default: fpu_unsupported(cpu, m, opcode); // FBLD, FBSTP
+    }
+}
+
+void fwait(cpu_state_t *cpu, __uint8_t opcode) { // FWAIT, exceptions are never left pending
+    (void)cpu;
+}
+
 void init_opcodes(Opcodes* opcodes) {
     opcodes[0x88] = mov_rm8_r8; // MOV r/m8, r8
     opcodes[0x8A] = mov_r8_rm8; // MOV r8, r/m8
@@ -349,5 +576,18 @@ void init_opcodes(Opcodes* opcodes) {
     opcodes[0xB8] = mov_reg16or32_imm16or32; // MOV reg16/32, imm16/32
     opcodes[0xC6] = mov_rm8_imm8; // MOV r/m8, imm8
     opcodes[0xC7] = mov_rm16or32_imm16or32; // MOV r/m16/32, imm16/32
+    opcodes[0xE4] = in_al_imm8; // IN AL, imm8
+    opcodes[0xE5] = in_axoreax_imm8; // IN AX/EAX, imm8
+    opcodes[0xEC] = in_al_dx; // IN AL, DX
+    opcodes[0xED] = in_axoreax_dx; // IN AX/EAX, DX
+    opcodes[0x9B] = fwait; // FWAIT
+    opcodes[0xD8] = fpu_d8; // x87 arithmetic m32real || ST(0), ST(i)
+    opcodes[0xD9] = fpu_d9; // x87 load/store m32real, control word, stack and constants
+    opcodes[0xDA] = fpu_da; // x87 arithmetic m32int, FUCOMPP
+    opcodes[0xDB] = fpu_db; // x87 load/store m32int/m80real, FNCLEX, FNINIT
+    opcodes[0xDC] = fpu_dc; // x87 arithmetic m64real || ST(i), ST(0)
+    opcodes[0xDD] = fpu_dd; // x87 load/store m64real, FNSTSW m16, FUCOM
+    opcodes[0xDE] = fpu_de; // x87 arithmetic m16int || pop forms, FCOMPP
+    opcodes[0xDF] = fpu_df; // x87 load/store m16int/m64int, FNSTSW AX
     opcodes[0xFF] = push_m16or32; // PUSH, m16/32
 }
\ No newline at end of file
@@ -0,0 +1,191 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/shm.h>
+#include "types.h"
+#include "tools.h"
+
+// In-process persistent fuzzing. The harness is set up once (image loaded, registers
+// initialized) and snapshotted; every input then restores only the pages the
+// previous run wrote, places the input in guest memory or behind an I/O port, and
+// runs under an instruction budget. Coverage is AFL-style: each executed
+// instruction is a location, and the hashed (previous, current) pair bumps a byte
+// in a 64 KiB bitmap, which is AFL's shared memory when __AFL_SHM_ID is set.
+
+#define FUZZ_MAP_SIZE (1 << 16)
+#define FUZZ_PAGE_SHIFT 12
+#define FUZZ_PAGES (MEMORY_REALMODE_SIZE >> FUZZ_PAGE_SHIFT)
+
+struct fuzz_harness {
+    __uint8_t *bitmap; // Edge hit counts
+    bool bitmap_shared; // Attached AFL shared memory, not ours to free
+    __uint32_t prev_loc;
+
+    bool via_port; // Input is read with IN from port, otherwise copied to load_phys
+    __uint16_t port;
+    __uint32_t load_phys;
+    unsigned long long budget; // Instructions per input
+
+    const __uint8_t *input; // Port mode: current input
+    size_t input_len;
+    size_t input_pos;
+
+    cpu_state_t initial; // Registers at snapshot time
+    __uint8_t *snapshot; // Memory at snapshot time
+    __uint16_t dirty[FUZZ_PAGES]; // Pages written since the last reset
+    __uint32_t dirty_count;
+    bool page_dirty[FUZZ_PAGES];
+
+    unsigned long long execs;
+};
+
+__uint32_t fuzz_port_in(void *ctx, __uint16_t port, __uint8_t size) { // Streams the input, little-endian, then all ones
+    fuzz_t *fz = (fuzz_t*)ctx;
+    __uint32_t value = 0;
+
+    if (port != fz->port) {
+        return 0xFFFFFFFF;
+    }
+
+    for (int i = 0; i < size; i++) {
+        __uint8_t byte = fz->input_pos < fz->input_len ? fz->input[fz->input_pos++] : 0xFF;
+        value |= (__uint32_t)byte << (i * 8);
+    }
+
+    return value;
+}
+
+void fuzz_note_write(cpu_state_t *cpu, __uint32_t phys, __uint32_t len) {
+    fuzz_t *fz = cpu->fuzz;
+    __uint32_t first = (phys & 0xFFFFF) >> FUZZ_PAGE_SHIFT;
+    __uint32_t last = ((phys + len - 1) & 0xFFFFF) >> FUZZ_PAGE_SHIFT;
+
+    for (__uint32_t page = first; ; page = (page + 1) % FUZZ_PAGES) {
+        if (!fz->page_dirty[page]) {
+            fz->page_dirty[page] = true;
+            fz->dirty[fz->dirty_count++] = page;
+        }
+        if (page == last) {
+            break;
+        }
+    }
+}
+
+fuzz_t* fuzz_open(cpu_state_t *cpu, bool via_port, __uint32_t where, unsigned long long budget) { // Snapshots cpu as it is now
+    fuzz_t *fz = (fuzz_t*)calloc(1, sizeof(fuzz_t));
+    if (!fz) {
+        perror("Fuzz harness allocating failed");
+        return NULL;
+    }
+
+    char *shm_id = getenv("__AFL_SHM_ID");
+    if (shm_id) {
+        fz->bitmap = (__uint8_t*)shmat(atoi(shm_id), NULL, 0);
+        if (fz->bitmap == (void*)-1) {
+            perror("Cannot attach AFL shared memory");
+            free(fz);
+            return NULL;
+        }
+        fz->bitmap_shared = true;
+    } else {
+        fz->bitmap = (__uint8_t*)calloc(FUZZ_MAP_SIZE, 1);
+    }
+
+    fz->snapshot = (__uint8_t*)malloc(MEMORY_REALMODE_SIZE);
+    if (!fz->bitmap || !fz->snapshot) {
+        perror("Fuzz harness allocating failed");
+        if (!fz->bitmap_shared) free(fz->bitmap);
+        free(fz->snapshot);
+        free(fz);
+        return NULL;
+    }
+
+    fz->via_port = via_port;
+    fz->port = via_port ? where : 0;
+    fz->load_phys = via_port ? 0 : where & 0xFFFFF;
+    fz->budget = budget;
+
+    if (via_port) {
+        cpu->port_ctx = fz;
+        cpu->port_in = fuzz_port_in;
+    }
+    cpu->icount = 0;
+    cpu->fuzz = fz;
+
+    memcpy(fz->snapshot, cpu->memory, MEMORY_REALMODE_SIZE);
+    fz->initial = *cpu;
+    return fz;
+}
+
+void fuzz_reset(cpu_state_t *cpu, const __uint8_t *data, size_t len) { // Back to the snapshot, with a new input in place
+    fuzz_t *fz = cpu->fuzz;
+
+    for (__uint32_t i = 0; i < fz->dirty_count; i++) {
+        __uint32_t offset = (__uint32_t)fz->dirty[i] << FUZZ_PAGE_SHIFT;
+        memcpy(&cpu->memory[offset], &fz->snapshot[offset], 1 << FUZZ_PAGE_SHIFT);
+        fz->page_dirty[fz->dirty[i]] = false;
+    }
+    fz->dirty_count = 0;
+
+    *cpu = fz->initial;
+    fz->prev_loc = 0;
+
+    if (fz->via_port) {
+        fz->input = data;
+        fz->input_len = len;
+        fz->input_pos = 0;
+    } else {
+        if (len > MEMORY_REALMODE_SIZE - fz->load_phys) {
+            len = MEMORY_REALMODE_SIZE - fz->load_phys;
+        }
+        memcpy(&cpu->memory[fz->load_phys], data, len);
+        if (len) {
+            fuzz_note_write(cpu, fz->load_phys, len);
+        }
+    }
+
+    fz->execs++;
+}
+
+bool fuzz_step(cpu_state_t *cpu) { // Per instruction: record the edge, true once the budget is spent
+    fuzz_t *fz = cpu->fuzz;
+
+    if (cpu->icount >= fz->budget) {
+        return true;
+    }
+
+    __uint32_t loc = translate_address(cpu, cpu->seg.cs.dword, cpu->eip.dword);
+    __uint32_t cur = ((loc >> 4) ^ (loc << 8)) & (FUZZ_MAP_SIZE - 1);
+    fz->bitmap[cur ^ fz->prev_loc]++;
+    fz->prev_loc = cur >> 1;
+
+    return false;
+}
+
+__uint32_t fuzz_coverage(fuzz_t *fz) { // Bitmap entries hit so far
+    __uint32_t hit = 0;
+
+    for (__uint32_t i = 0; i < FUZZ_MAP_SIZE; i++) {
+        hit += fz->bitmap[i] != 0;
+    }
+
+    return hit;
+}
+
+void fuzz_close(cpu_state_t *cpu) {
+    fuzz_t *fz = cpu->fuzz;
+
+    if (fz->bitmap_shared) {
+        shmdt(fz->bitmap);
+    } else {
+        free(fz->bitmap);
+    }
+    free(fz->snapshot);
+    free(fz);
+
+    cpu->fuzz = NULL;
+    cpu->port_in = NULL;
+    cpu->port_ctx = NULL;
+}
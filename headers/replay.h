@@ -0,0 +1,238 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "types.h"
+#include "tools.h"
+#include "fpu.h"
+
+// Deterministic record/replay of everything the guest can observe that does not
+// come from its own memory. In this tree that is IN port reads: there is no INT,
+// IRET or timer, so no interrupts, BIOS calls or host time reach the guest. Every
+// event is keyed by cpu->icount, so playback reproduces the run without touching
+// real devices.
+//
+// Log layout: "I386RPL" + version byte + FPU precision byte, then records of
+//   tag byte | varint icount delta | payload
+// and a final REPLAY_END record carrying a checksum of cpu_state_t and memory.
+// Integers are LEB128 varints and icounts are delta-coded, so a typical record
+// is 3-5 bytes. The log is not compressed beyond that.
+
+#define REPLAY_MAGIC "I386RPL"
+#define REPLAY_VERSION 3
+
+typedef enum {
+    REPLAY_OFF,
+    REPLAY_RECORD,
+    REPLAY_PLAYBACK
+} replay_mode_t;
+
+typedef enum {
+    REPLAY_PORT_IN = 1,
+    REPLAY_END
+} replay_event_t;
+
+struct replay_log {
+    replay_mode_t mode;
+    FILE *file; // Record: output stream
+    unsigned long long last_icount; // icount of the previous record (delta base)
+
+    __uint8_t *buf; // Playback: whole log, read up front
+    size_t len;
+    size_t pos;
+
+    __uint8_t next_tag; // Playback: header of the record at pos, already decoded
+    unsigned long long next_icount;
+};
+
+unsigned long long cpu_checksum(cpu_state_t *cpu) { // FNV-1a over architectural state and memory
+    __uint32_t regs[16] = {
+        cpu->gpr.eax.dword, cpu->gpr.ebx.dword, cpu->gpr.ecx.dword, cpu->gpr.edx.dword,
+        cpu->gpr.esi.dword, cpu->gpr.edi.dword, cpu->gpr.ebp.dword, cpu->gpr.esp.dword,
+        cpu->eip.dword, cpu->eflags.dword,
+        cpu->seg.cs.dword, cpu->seg.ds.dword, cpu->seg.ss.dword,
+        cpu->seg.es.dword, cpu->seg.fs.dword, cpu->seg.gs.dword
+    };
+
+    unsigned long long h = fnv1a(FNV1A_INIT, regs, sizeof(regs));
+    h = fpu_checksum(cpu, h);
+    return fnv1a(h, cpu->memory, MEMORY_REALMODE_SIZE);
+}
+
+void replay_put_varint(replay_t *r, unsigned long long value) {
+    while (value >= 0x80) {
+        fputc((int)(value & 0x7F) | 0x80, r->file);
+        value >>= 7;
+    }
+    fputc((int)value, r->file);
+}
+
+unsigned long long replay_get_varint(replay_t *r) {
+    unsigned long long value = 0;
+    int shift = 0;
+
+    while (true) {
+        if (r->pos >= r->len || shift > 63) {
+            fprintf(stderr, "Replay log truncated at offset %zu\n", r->pos);
+            abort();
+        }
+        __uint8_t byte = r->buf[r->pos++];
+        value |= (unsigned long long)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            return value;
+        }
+        shift += 7;
+    }
+}
+
+void replay_put_header(cpu_state_t *cpu, replay_event_t tag) {
+    replay_t *r = cpu->replay;
+    fputc(tag, r->file);
+    replay_put_varint(r, cpu->icount - r->last_icount);
+    r->last_icount = cpu->icount;
+}
+
+void replay_peek(replay_t *r) { // Decode the header of the next record
+    if (r->pos >= r->len) {
+        fprintf(stderr, "Replay log ended without REPLAY_END\n");
+        abort();
+    }
+
+    r->next_tag = r->buf[r->pos++];
+    r->next_icount = r->last_icount + replay_get_varint(r);
+    r->last_icount = r->next_icount;
+}
+
+void replay_expect(cpu_state_t *cpu, replay_event_t tag) { // Playback: current record must be tag at this icount
+    replay_t *r = cpu->replay;
+    if (r->next_tag != tag || r->next_icount != cpu->icount) {
+        fprintf(stderr, "Replay diverged: expected event %u at icount %llu, log has event %u at icount %llu\n",
+                tag, cpu->icount, r->next_tag, r->next_icount);
+        abort();
+    }
+}
+
+// The checksum covers the FPU registers, whose contents depend on --fpu, so the
+// mode is part of the log: playback adopts it, or refuses if fpu_given conflicts.
+replay_t* replay_open(cpu_state_t *cpu, const char *path, replay_mode_t mode, bool fpu_given) {
+    replay_t *r = (replay_t*)calloc(1, sizeof(replay_t));
+    if (!r) {
+        perror("Replay allocating failed");
+        return NULL;
+    }
+    r->mode = mode;
+
+    if (mode == REPLAY_RECORD) {
+        r->file = fopen(path, "wb");
+        if (!r->file) { perror("Cannot open replay log"); free(r); return NULL; }
+
+        fwrite(REPLAY_MAGIC, 1, sizeof(REPLAY_MAGIC) - 1, r->file);
+        fputc(REPLAY_VERSION, r->file);
+        fputc(cpu->fpu.precision, r->file);
+        return r;
+    }
+
+    FILE *f = fopen(path, "rb");
+    if (!f) { perror("Cannot open replay log"); free(r); return NULL; }
+
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    r->buf = (__uint8_t*)malloc(size > 0 ? size : 1);
+    if (!r->buf || fread(r->buf, 1, size, f) != (size_t)size) {
+        perror("Cannot read replay log");
+        fclose(f);
+        free(r->buf);
+        free(r);
+        return NULL;
+    }
+    fclose(f);
+    r->len = size;
+
+    size_t magic_len = sizeof(REPLAY_MAGIC) - 1;
+    if (r->len < magic_len + 2 || memcmp(r->buf, REPLAY_MAGIC, magic_len) != 0 || r->buf[magic_len] != REPLAY_VERSION ||
+        r->buf[magic_len + 1] > FPU_EXACT) {
+        fprintf(stderr, "Not a replay log (or unsupported version): %s\n", path);
+        free(r->buf);
+        free(r);
+        return NULL;
+    }
+
+    fpu_precision_t precision = (fpu_precision_t)r->buf[magic_len + 1];
+    if (precision != cpu->fpu.precision) {
+        if (fpu_given) {
+            fprintf(stderr, "Replay log %s was recorded with --fpu %s, cannot replay it with --fpu %s\n",
+                    path, precision == FPU_EXACT ? "exact" : "fast", cpu->fpu.precision == FPU_EXACT ? "exact" : "fast");
+            free(r->buf);
+            free(r);
+            return NULL;
+        }
+        fpu_init(cpu, precision);
+    }
+    r->pos = magic_len + 2;
+
+    replay_peek(r);
+    return r;
+}
+
+bool replay_close(cpu_state_t *cpu) { // Writes or verifies the final checksum, returns false on mismatch
+    replay_t *r = cpu->replay;
+    bool ok = true;
+    unsigned long long sum = cpu_checksum(cpu);
+
+    if (r->mode == REPLAY_RECORD) {
+        replay_put_header(cpu, REPLAY_END);
+        for (int i = 0; i < 8; i++) {
+            fputc((int)((sum >> (i * 8)) & 0xFF), r->file);
+        }
+        fclose(r->file);
+    } else {
+        replay_expect(cpu, REPLAY_END);
+        if (r->pos + 8 > r->len) {
+            fprintf(stderr, "Replay log truncated at offset %zu\n", r->pos);
+            abort();
+        }
+
+        unsigned long long expected = 0;
+        for (int i = 0; i < 8; i++) {
+            expected |= (unsigned long long)r->buf[r->pos++] << (i * 8);
+        }
+
+        ok = (expected == sum);
+        fprintf(stderr, "Replay checksum %s: %016llx (recorded %016llx)\n", ok ? "OK" : "MISMATCH", sum, expected);
+        free(r->buf);
+    }
+
+    free(r);
+    cpu->replay = NULL;
+    return ok;
+}
+
+__uint32_t port_read(cpu_state_t *cpu, __uint16_t port, __uint8_t size) { // IN, size in bytes
+    replay_t *r = cpu->replay;
+
+    if (r && r->mode == REPLAY_PLAYBACK) {
+        replay_expect(cpu, REPLAY_PORT_IN);
+        __uint16_t logged_port = replay_get_varint(r);
+        __uint32_t value = replay_get_varint(r);
+        if (logged_port != port) {
+            fprintf(stderr, "Replay diverged: IN from port 0x%X, log has port 0x%X\n", port, logged_port);
+            abort();
+        }
+        replay_peek(r);
+        return value;
+    }
+
+    __uint32_t mask = (size == 4) ? 0xFFFFFFFF : (1u << (size * 8)) - 1;
+    __uint32_t value = cpu->port_in ? cpu->port_in(cpu->port_ctx, port, size) & mask : mask;
+
+    if (r && r->mode == REPLAY_RECORD) {
+        replay_put_header(cpu, REPLAY_PORT_IN);
+        replay_put_varint(r, port);
+        replay_put_varint(r, value);
+    }
+
+    return value;
+}
@@ -0,0 +1,316 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "types.h"
+#include "tools.h"
+
+// Persistent decode cache. For every linear address that has been executed it keeps
+// the whole decoded instruction (prefixes, opcode, ModR/M byte, memory operand with
+// the SIB byte folded in, displacement, immediate and total length). On a hit the
+// fetch is one table load, and decode_modrm, effective_address and fetch_immediate
+// hand the handler the cached fields instead of reading the instruction stream.
+//
+// On a miss the handler decodes from memory as usual and the helpers record what it
+// consumed; the entry is kept after the handler returns if the instruction did not
+// store into its own bytes. Stores drop the entries they overlap, so live entries
+// always match memory.
+//
+// Entries also carry their raw bytes. The file groups them per 4 KiB page with an
+// FNV-1a hash of the page as it was when the cache was written. The next run mmaps
+// the file and takes a page's entries as they are if the hash still matches current
+// memory; otherwise each entry is checked against memory byte by byte, so a page
+// whose data changed keeps the instructions that did not.
+//
+// File layout: magic, u32 page count, u32 entry count, page headers, then the entries
+// of each page in header order.
+
+#define TCACHE_MAGIC "I386TC\0\2"
+#define TCACHE_PAGE_SHIFT 12
+#define TCACHE_PAGE_SIZE (1 << TCACHE_PAGE_SHIFT)
+#define TCACHE_PAGES (MEMORY_REALMODE_SIZE >> TCACHE_PAGE_SHIFT)
+
+typedef struct {
+    __uint32_t page;
+    __uint32_t count; // Entries saved for this page
+    unsigned long long hash; // Page contents when the file was written
+} tcache_page_header_t;
+
+typedef struct {
+    __uint16_t offset; // Within the page
+    __uint16_t reserved;
+    decoded_insn_t insn;
+} tcache_record_t;
+
+struct tcache {
+    const char *path;
+    decoded_insn_t *pages[TCACHE_PAGES]; // TCACHE_PAGE_SIZE entries each, NULL = nothing decoded on this page
+
+    decoded_insn_t scratch; // Miss: the instruction being decoded
+    __uint32_t scratch_phys;
+
+    struct timespec start; // Process start, for the cold-start latency report
+    double first_insn_us; // < 0 until the first instruction has been fetched
+    unsigned long long hits;
+    unsigned long long misses;
+    __uint32_t loaded; // Entries taken from the file
+    __uint32_t rejected; // Entries whose bytes no longer match memory
+    __uint32_t pages_hashed; // Pages accepted on the hash alone
+};
+
+unsigned long long tcache_page_hash(cpu_state_t *cpu, __uint32_t page) { // FNV-1a over one page
+    return fnv1a(FNV1A_INIT, &cpu->memory[page << TCACHE_PAGE_SHIFT], TCACHE_PAGE_SIZE);
+}
+
+decoded_insn_t* tcache_page(tcache_t *tc, __uint32_t page) { // Entry array of a page, allocated on first use
+    if (!tc->pages[page]) {
+        tc->pages[page] = (decoded_insn_t*)calloc(TCACHE_PAGE_SIZE, sizeof(decoded_insn_t));
+        if (!tc->pages[page]) {
+            perror("Translation cache allocating failed");
+            abort();
+        }
+    }
+    return tc->pages[page];
+}
+
+tcache_t* tcache_open(cpu_state_t *cpu, const char *path, struct timespec start) { // Call after the image is loaded
+    tcache_t *tc = (tcache_t*)calloc(1, sizeof(tcache_t));
+    if (!tc) {
+        perror("Translation cache allocating failed");
+        return NULL;
+    }
+    tc->path = path;
+    tc->start = start;
+    tc->first_insn_us = -1;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return tc; // First run, nothing cached yet
+    }
+
+    struct stat st;
+    size_t magic_len = sizeof(TCACHE_MAGIC) - 1;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)(magic_len + 2 * sizeof(__uint32_t))) {
+        close(fd);
+        return tc;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("Cannot map translation cache");
+        return tc;
+    }
+
+    __uint8_t *p = (__uint8_t*)map;
+    __uint32_t page_count, entry_count;
+    memcpy(&page_count, p + magic_len, sizeof(page_count));
+    memcpy(&entry_count, p + magic_len + sizeof(page_count), sizeof(entry_count));
+
+    size_t headers_start = magic_len + 2 * sizeof(__uint32_t);
+    size_t records_start = headers_start + (size_t)page_count * sizeof(tcache_page_header_t);
+    if (memcmp(p, TCACHE_MAGIC, magic_len) != 0 || page_count > TCACHE_PAGES || entry_count > TCACHE_PAGES * TCACHE_PAGE_SIZE ||
+        records_start + (size_t)entry_count * sizeof(tcache_record_t) != (size_t)st.st_size) {
+        fprintf(stderr, "Ignoring malformed translation cache: %s\n", path);
+        munmap(map, st.st_size);
+        return tc;
+    }
+
+    const tcache_page_header_t *headers = (const tcache_page_header_t*)(p + headers_start);
+    const tcache_record_t *records = (const tcache_record_t*)(p + records_start);
+    size_t next = 0;
+
+    for (__uint32_t i = 0; i < page_count; i++) {
+        __uint32_t page = headers[i].page;
+        __uint32_t count = headers[i].count;
+        if (page >= TCACHE_PAGES || count > entry_count - next) {
+            fprintf(stderr, "Ignoring malformed translation cache: %s\n", path);
+            break;
+        }
+
+        bool hashed = tcache_page_hash(cpu, page) == headers[i].hash;
+        tc->pages_hashed += hashed;
+
+        for (__uint32_t j = 0; j < count; j++) {
+            const tcache_record_t *r = &records[next + j];
+            __uint32_t length = r->insn.length;
+
+            if (r->offset >= TCACHE_PAGE_SIZE || length == 0 || length > INSN_MAX_LENGTH || r->offset + length > TCACHE_PAGE_SIZE ||
+                (!hashed && memcmp(r->insn.bytes, &cpu->memory[(page << TCACHE_PAGE_SHIFT) + r->offset], length) != 0)) {
+                tc->rejected++;
+                continue;
+            }
+
+            tcache_page(tc, page)[r->offset] = r->insn;
+            tc->loaded++;
+        }
+        next += count;
+    }
+
+    munmap(map, st.st_size);
+    return tc;
+}
+
+void tcache_invalidate(cpu_state_t *cpu, __uint32_t phys, __uint32_t len) { // Drop entries overlapping [phys, phys + len)
+    tcache_t *tc = cpu->tcache;
+    __uint32_t first = phys & 0xFFFFF;
+    __uint32_t last = (phys + len - 1) & 0xFFFFF;
+
+    for (__uint32_t page = first >> TCACHE_PAGE_SHIFT; ; page = (page + 1) % TCACHE_PAGES) {
+        decoded_insn_t *entries = tc->pages[page];
+
+        if (entries) {
+            // Entries never cross a page, so only starts on this page up to INSN_MAX_LENGTH bytes before the store can overlap it
+            __uint32_t page_base = page << TCACHE_PAGE_SHIFT;
+            __uint32_t lo = (first >> TCACHE_PAGE_SHIFT == page) ? first - page_base : 0;
+            __uint32_t hi = (last >> TCACHE_PAGE_SHIFT == page) ? last - page_base : TCACHE_PAGE_SIZE - 1;
+            __uint32_t from = lo >= INSN_MAX_LENGTH ? lo - INSN_MAX_LENGTH : 0;
+
+            for (__uint32_t i = from; i <= hi; i++) {
+                if (entries[i].length && i + entries[i].length > lo) {
+                    entries[i].length = 0;
+                }
+            }
+        }
+
+        if (page == last >> TCACHE_PAGE_SHIFT) {
+            break;
+        }
+    }
+}
+
+__uint8_t tcache_fetch(cpu_state_t *cpu, __uint8_t *memory) { // Drop-in for fetch_instruction_rmode
+    tcache_t *tc = cpu->tcache;
+    __uint32_t phys = translate_address(cpu, cpu->seg.cs.dword, cpu->eip.dword);
+    decoded_insn_t *entries = tc->pages[phys >> TCACHE_PAGE_SHIFT];
+    decoded_insn_t *e = entries ? &entries[phys & (TCACHE_PAGE_SIZE - 1)] : NULL;
+    __uint8_t opcode;
+
+    if (e && e->length) {
+        cpu->prefix.x66_mode = e->prefix & 1;
+        cpu->prefix.x67_mode = (e->prefix >> 1) & 1;
+        cpu->eip.dword += e->length;
+        cpu->insn = e;
+        cpu->insn_cached = true;
+        opcode = e->opcode;
+        tc->hits++;
+    } else {
+        decoded_insn_t *d = &tc->scratch;
+        memset(d, 0, sizeof(*d));
+        for (int i = 0; i < INSN_MAX_LENGTH; i++) {
+            d->bytes[i] = memory[(phys + i) & 0xFFFFF];
+        }
+        tc->scratch_phys = phys;
+
+        __uint32_t start = cpu->eip.dword;
+        opcode = fetch_instruction_rmode(cpu, memory);
+        __uint32_t head = cpu->eip.dword - start;
+
+        d->length = head > INSN_MAX_LENGTH ? INSN_MAX_LENGTH + 1 : head;
+        d->opcode = opcode;
+        d->prefix = cpu->prefix.x66_mode | (cpu->prefix.x67_mode << 1);
+        cpu->insn = d;
+        cpu->insn_cached = false;
+        tc->misses++;
+    }
+
+    if (tc->first_insn_us < 0) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        tc->first_insn_us = (now.tv_sec - tc->start.tv_sec) * 1e6 + (now.tv_nsec - tc->start.tv_nsec) / 1e3;
+    }
+
+    return opcode;
+}
+
+void tcache_retire(cpu_state_t *cpu) { // After the handler: keep the instruction just decoded on a miss
+    tcache_t *tc = cpu->tcache;
+    decoded_insn_t *d = &tc->scratch;
+    __uint32_t phys = tc->scratch_phys;
+    __uint32_t offset = phys & (TCACHE_PAGE_SIZE - 1);
+
+    if (cpu->insn_cached) {
+        return;
+    }
+    cpu->insn = NULL;
+
+    if ((d->flags & INSN_UNCACHEABLE) || d->length > INSN_MAX_LENGTH || offset + d->length > TCACHE_PAGE_SIZE) {
+        return;
+    }
+    if (memcmp(d->bytes, &cpu->memory[phys], d->length) != 0) {
+        return; // Stored into its own encoding, the decode describes bytes that are gone
+    }
+
+    tcache_page(tc, phys >> TCACHE_PAGE_SHIFT)[offset] = *d;
+}
+
+void tcache_close(cpu_state_t *cpu) { // Report, write the cache back and release it
+    tcache_t *tc = cpu->tcache;
+    __uint32_t page_count = 0, entry_count = 0;
+    __uint32_t counts[TCACHE_PAGES] = {0};
+
+    for (__uint32_t page = 0; page < TCACHE_PAGES; page++) {
+        if (!tc->pages[page]) {
+            continue;
+        }
+        for (__uint32_t i = 0; i < TCACHE_PAGE_SIZE; i++) {
+            counts[page] += tc->pages[page][i].length != 0;
+        }
+        page_count += counts[page] != 0;
+        entry_count += counts[page];
+    }
+
+    fprintf(stderr, "tcache: cold start to first instruction %.1f us, %llu hits, %llu misses, "
+                    "%u entries loaded (%u pages by hash), %u rejected, %u saved\n",
+            tc->first_insn_us, tc->hits, tc->misses, tc->loaded, tc->pages_hashed, tc->rejected, entry_count);
+
+    // Write a fresh file and rename it over the old one, so a crash never leaves a torn cache
+    size_t tmp_len = strlen(tc->path) + 5;
+    char *tmp = (char*)malloc(tmp_len);
+    FILE *f = tmp ? (snprintf(tmp, tmp_len, "%s.tmp", tc->path), fopen(tmp, "wb")) : NULL;
+
+    if (f) {
+        fwrite(TCACHE_MAGIC, 1, sizeof(TCACHE_MAGIC) - 1, f);
+        fwrite(&page_count, sizeof(page_count), 1, f);
+        fwrite(&entry_count, sizeof(entry_count), 1, f);
+
+        for (__uint32_t page = 0; page < TCACHE_PAGES; page++) {
+            if (counts[page]) {
+                // Live entries always match memory, so the current contents describe all of them
+                tcache_page_header_t header = { page, counts[page], tcache_page_hash(cpu, page) };
+                fwrite(&header, sizeof(header), 1, f);
+            }
+        }
+
+        for (__uint32_t page = 0; page < TCACHE_PAGES; page++) {
+            for (__uint32_t i = 0; counts[page] && i < TCACHE_PAGE_SIZE; i++) {
+                if (tc->pages[page][i].length) {
+                    tcache_record_t record = { (__uint16_t)i, 0, tc->pages[page][i] };
+                    fwrite(&record, sizeof(record), 1, f);
+                }
+            }
+        }
+
+        if (fclose(f) != 0 || rename(tmp, tc->path) != 0) {
+            perror("Cannot write translation cache");
+            remove(tmp);
+        }
+    } else {
+        perror("Cannot write translation cache");
+    }
+    free(tmp);
+
+    for (__uint32_t page = 0; page < TCACHE_PAGES; page++) {
+        free(tc->pages[page]);
+    }
+
+    free(tc);
+    cpu->tcache = NULL;
+    cpu->insn = NULL;
+}
@@ -1,6 +1,9 @@
 #pragma once
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stddef.h>
 #include "types.h"
 
 __uint32_t translate_address(cpu_state_t *cpu, __uint16_t segment, __uint32_t offset) {
@@ -15,6 +18,47 @@ __uint32_t translate_address(cpu_state_t *cpu, __uint16_t segment, __uint32_t of
     }
 }
 
+void tcache_invalidate(cpu_state_t *cpu, __uint32_t phys, __uint32_t len); // tcache.h
+void vga_note_write(cpu_state_t *cpu, __uint32_t phys, __uint32_t len); // vga.h
+void fuzz_note_write(cpu_state_t *cpu, __uint32_t phys, __uint32_t len); // fuzz.h
+
+void note_write(cpu_state_t *cpu, __uint32_t phys, __uint32_t len) { // Every guest memory store goes through here
+    if (cpu->tcache) {
+        tcache_invalidate(cpu, phys, len);
+    }
+    if (cpu->vga) {
+        vga_note_write(cpu, phys, len);
+    }
+    if (cpu->fuzz) {
+        fuzz_note_write(cpu, phys, len);
+    }
+}
+
+#define FNV1A_INIT 0xCBF29CE484222325ULL
+
+unsigned long long fnv1a(unsigned long long h, const void *bytes, size_t len) { // Continue an FNV-1a hash over len bytes
+    const __uint8_t *p = (const __uint8_t*)bytes;
+
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ p[i]) * 0x100000001B3ULL;
+    }
+
+    return h;
+}
+
+void unsupported(cpu_state_t *cpu, const char *format, ...) { // Emulator gap: abort, or let the fuzz loop end the input
+    cpu->unsupported = true;
+    if (cpu->fuzz) {
+        return;
+    }
+
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+    abort();
+}
+
 __uint8_t read_byte(cpu_state_t *cpu, __uint16_t segment, __uint32_t offset) {
     __uint32_t phys = translate_address(cpu, segment, offset);
     return cpu->memory[(phys) & 0xFFFFF];
@@ -30,15 +74,21 @@ __uint32_t read_double_word(cpu_state_t *cpu, __uint16_t segment, __uint32_t off
     return cpu->memory[(phys) & 0xFFFFF] | (cpu->memory[(phys+1) & 0xFFFFF] << 8) | (cpu->memory[(phys+2) & 0xFFFFF] << 16) | (cpu->memory[(phys+3) & 0xFFFFF] << 24);
 }
 
+unsigned long long read_quad_word(cpu_state_t *cpu, __uint16_t segment, __uint32_t offset) {
+    return read_double_word(cpu, segment, offset) | ((unsigned long long)read_double_word(cpu, segment, offset + 4) << 32);
+}
+
 void write_byte(cpu_state_t *cpu, __uint16_t segment, __uint32_t offset, __uint8_t value) {
     __uint32_t phys = translate_address(cpu, segment, offset);
     cpu->memory[(phys) & 0xFFFFF] = value;
+    note_write(cpu, phys, 1);
 }
 
 void write_word(cpu_state_t *cpu, __uint16_t segment, __uint32_t offset, __uint16_t value) {
     __uint32_t phys = translate_address(cpu, segment, offset);
     cpu->memory[(phys) & 0xFFFFF] = value & 0xFF;
     cpu->memory[(phys+1) & 0xFFFFF] = (value) >> 8 & 0xFF;
+    note_write(cpu, phys, 2);
 }
 
 void write_double_word(cpu_state_t *cpu, __uint16_t segment, __uint32_t offset, __uint32_t value) {
@@ -47,6 +97,12 @@ void write_double_word(cpu_state_t *cpu, __uint16_t segment, __uint32_t offset,
     cpu->memory[(phys+1) & 0xFFFFF] = (value >> 8) & 0xFF;
     cpu->memory[(phys+2) & 0xFFFFF] = (value >> 16) & 0xFF;
     cpu->memory[(phys+3) & 0xFFFFF] = (value >> 24) & 0xFF;
+    note_write(cpu, phys, 4);
+}
+
+void write_quad_word(cpu_state_t *cpu, __uint16_t segment, __uint32_t offset, unsigned long long value) {
+    write_double_word(cpu, segment, offset, value & 0xFFFFFFFF);
+    write_double_word(cpu, segment, offset + 4, value >> 32);
 }
 
 __uint8_t* get_reg8(cpu_state_t *cpu, __uint8_t reg) {
@@ -120,6 +176,7 @@ void word_to_stack(cpu_state_t *cpu, __uint16_t value) {
 
         cpu->memory[linear_addr] = value & 0xFF;
         cpu->memory[linear_addr + 1] = (value >> 8) & 0xFF;
+        note_write(cpu, linear_addr, 2);
     } else if (cpu->mode == PROTECTED_MODE) {
         cpu->gpr.esp.dword -= 2;
 
@@ -127,6 +184,7 @@ void word_to_stack(cpu_state_t *cpu, __uint16_t value) {
 
         cpu->memory[linear_addr] = value & 0xFF;
         cpu->memory[linear_addr + 1] = (value >> 8) & 0xFF;
+        note_write(cpu, linear_addr, 2);
     }
 }
 
@@ -140,6 +198,7 @@ void double_word_to_stack(cpu_state_t *cpu, __uint32_t value) {
         cpu->memory[linear_addr + 1] = (value >> 8) & 0xFF;
         cpu->memory[linear_addr + 2] = (value >> 16) & 0xFF;
         cpu->memory[linear_addr + 3] = (value >> 24) & 0xFF;
+        note_write(cpu, linear_addr, 4);
     } else if (cpu->mode == PROTECTED_MODE) {
         cpu->gpr.esp.dword -= 4;
 
@@ -149,15 +208,57 @@ void double_word_to_stack(cpu_state_t *cpu, __uint32_t value) {
         cpu->memory[linear_addr + 1] = (value >> 8) & 0xFF;
         cpu->memory[linear_addr + 2] = (value >> 16) & 0xFF;
         cpu->memory[linear_addr + 3] = (value >> 24) & 0xFF;
+        note_write(cpu, linear_addr, 4);
+    }
+}
+
+// Instruction stream operands. With the decode cache on, cpu->insn is either a
+// cached decode (insn_cached), which the helpers below return without touching
+// memory or EIP, or the entry being recorded for the current instruction, which
+// they fill in as they read.
+
+void insn_record(decoded_insn_t *d, __uint8_t part, __uint8_t bytes) { // Recording: the handler consumed part, bytes long
+    d->flags |= (d->flags & part) ? INSN_UNCACHEABLE : part;
+    d->length += bytes;
+}
+
+__uint32_t fetch_immediate(cpu_state_t *cpu, __uint8_t size) { // Immediate or moffs of 1, 2 or 4 bytes, zero-extended
+    decoded_insn_t *d = cpu->insn;
+    if (d && cpu->insn_cached) {
+        return d->imm;
+    }
+
+    __uint32_t value = size == 1 ? read_byte(cpu, cpu->seg.cs.dword, cpu->eip.dword)
+                     : size == 2 ? read_word(cpu, cpu->seg.cs.dword, cpu->eip.dword)
+                     : read_double_word(cpu, cpu->seg.cs.dword, cpu->eip.dword);
+    cpu->eip.dword += size;
+
+    if (d) {
+        insn_record(d, INSN_IMM, size);
+        d->imm = value;
     }
+    return value;
 }
 
 modrm_t decode_modrm(cpu_state_t* cpu) {
-    __uint8_t byte = read_byte(cpu, cpu->seg.cs.dword, cpu->eip.dword++);
+    decoded_insn_t *d = cpu->insn;
+    __uint8_t byte;
+
+    if (d && cpu->insn_cached) {
+        byte = d->modrm;
+    } else {
+        byte = read_byte(cpu, cpu->seg.cs.dword, cpu->eip.dword++);
+        if (d) {
+            insn_record(d, INSN_MODRM, 1);
+            d->modrm = byte;
+        }
+    }
+
     modrm_t m;
     m.mod = (byte >> 6) & 0x03;
     m.reg = (byte >> 3) & 0x07;
     m.rm = byte & 0x07;
+    m.byte = byte;
 
     return m;
 }
@@ -171,7 +272,120 @@ sib_t decode_sib(cpu_state_t *cpu) {
     return s;
 }
 
-__uint32_t effective_sib_address(cpu_state_t *cpu, modrm_t m, sib_t s, __uint16_t* out_segment) {
+// ModR/M and SIB decode tables, built by the preprocessor. Each entry says which
+// registers form the address, the default segment and how many displacement bytes
+// follow, so effective_address is a table load plus adds instead of nested switches.
+// Register indexes resolve through offset tables in encoding order; EA_NONE maps to
+// cpu->zero, so a missing base or index adds 0 without a branch.
+
+#define EA_NONE 8
+#define EA_SREG_SS 2
+#define EA_SREG_DS 3
+
+#define EA_MOD(b) ((b) >> 6)
+#define EA_RM(b) ((b) & 7)
+
+// 16-bit: BX+SI, BX+DI, BP+SI, BP+DI, SI, DI, BP (disp16 when mod = 0), BX
+#define EA16_BASE(b) (EA_RM(b) <= 1 || EA_RM(b) == 7 ? 3 : EA_RM(b) <= 3 ? 5 : EA_RM(b) == 4 ? 6 : EA_RM(b) == 5 ? 7 : EA_MOD(b) == 0 ? EA_NONE : 5)
+#define EA16_INDEX(b) (EA_RM(b) <= 3 ? (EA_RM(b) & 1 ? 7 : 6) : EA_NONE)
+#define EA16_SEGMENT(b) (EA_RM(b) == 2 || EA_RM(b) == 3 || (EA_RM(b) == 6 && EA_MOD(b) != 0) ? EA_SREG_SS : EA_SREG_DS)
+#define EA16_DISP(b) (EA_MOD(b) == 1 ? 1 : EA_MOD(b) == 2 || (EA_MOD(b) == 0 && EA_RM(b) == 6) ? 2 : 0)
+#define EA16(b) { EA16_BASE(b), EA16_INDEX(b), 0, EA16_SEGMENT(b), EA16_DISP(b), false }
+
+// 32-bit: rm = 4 defers to the SIB byte, rm = 5 with mod = 0 is a bare disp32
+#define EA32_BASE(b) (EA_RM(b) == 4 || (EA_RM(b) == 5 && EA_MOD(b) == 0) ? EA_NONE : EA_RM(b))
+#define EA32_SEGMENT(b) (EA_RM(b) == 5 && EA_MOD(b) != 0 ? EA_SREG_SS : EA_SREG_DS)
+#define EA32_DISP(b) (EA_MOD(b) == 1 ? 1 : EA_MOD(b) == 2 || (EA_MOD(b) == 0 && EA_RM(b) == 5) ? 4 : 0)
+#define EA32(b) { EA32_BASE(b), EA_NONE, 0, EA32_SEGMENT(b), EA32_DISP(b), EA_RM(b) == 4 && EA_MOD(b) != 3 }
+
+// SIB, indexed by [mod == 0][sib]: index 4 means none, base 5 with mod = 0 is a bare disp32
+#define SIB_INDEX(b) (((b) >> 3 & 7) == 4 ? EA_NONE : ((b) >> 3 & 7))
+#define SIB_NO_BASE(b, mod0) (EA_RM(b) == 5 && (mod0))
+#define SIB(b, mod0) { SIB_NO_BASE(b, mod0) ? EA_NONE : EA_RM(b), SIB_INDEX(b), EA_MOD(b), \
+    !SIB_NO_BASE(b, mod0) && (EA_RM(b) == 4 || EA_RM(b) == 5) ? EA_SREG_SS : EA_SREG_DS, SIB_NO_BASE(b, mod0) ? 4 : 0, false }
+#define SIB_MOD0(b) SIB(b, 1)
+#define SIB_MODX(b) SIB(b, 0)
+
+#define EA_ROW4(E, b) E(b), E((b) + 1), E((b) + 2), E((b) + 3)
+#define EA_ROW16(E, b) EA_ROW4(E, b), EA_ROW4(E, (b) + 4), EA_ROW4(E, (b) + 8), EA_ROW4(E, (b) + 12)
+#define EA_ROW64(E, b) EA_ROW16(E, b), EA_ROW16(E, (b) + 16), EA_ROW16(E, (b) + 32), EA_ROW16(E, (b) + 48)
+#define EA_TABLE(E) { EA_ROW64(E, 0), EA_ROW64(E, 64), EA_ROW64(E, 128), EA_ROW64(E, 192) }
+
+static const ea_decode_t modrm_ea16[256] = EA_TABLE(EA16);
+static const ea_decode_t modrm_ea32[256] = EA_TABLE(EA32);
+static const ea_decode_t sib_ea[2][256] = { EA_TABLE(SIB_MODX), EA_TABLE(SIB_MOD0) };
+
+static const __uint16_t ea_reg_offset[EA_NONE + 1] = {
+    offsetof(cpu_state_t, gpr.eax), offsetof(cpu_state_t, gpr.ecx), offsetof(cpu_state_t, gpr.edx), offsetof(cpu_state_t, gpr.ebx),
+    offsetof(cpu_state_t, gpr.esp), offsetof(cpu_state_t, gpr.ebp), offsetof(cpu_state_t, gpr.esi), offsetof(cpu_state_t, gpr.edi),
+    offsetof(cpu_state_t, zero)
+};
+static const __uint16_t ea_sreg_offset[6] = {
+    offsetof(cpu_state_t, seg.es), offsetof(cpu_state_t, seg.cs), offsetof(cpu_state_t, seg.ss),
+    offsetof(cpu_state_t, seg.ds), offsetof(cpu_state_t, seg.fs), offsetof(cpu_state_t, seg.gs)
+};
+
+#define EA_REG(cpu, i) (*(__uint32_t*)((__uint8_t*)(cpu) + ea_reg_offset[i]))
+#define EA_SREG(cpu, i) (*(__uint16_t*)((__uint8_t*)(cpu) + ea_sreg_offset[i]))
+
+__uint32_t effective_address(cpu_state_t *cpu, modrm_t m, __uint16_t* out_segment) {
+    decoded_insn_t *d = cpu->insn;
+    const ea_decode_t *e;
+    __uint32_t disp = 0;
+
+    if (d && cpu->insn_cached) {
+        e = &d->ea;
+        disp = d->disp;
+    } else {
+        bool addr32 = (cpu->mode != REAL_MODE) || (cpu->mode == REAL_MODE && cpu->prefix.x67_mode);
+        e = addr32 ? &modrm_ea32[m.byte] : &modrm_ea16[m.byte];
+        __uint8_t disp_size = e->disp_size;
+        __uint8_t sib_size = e->sib;
+
+        if (e->sib) {
+            __uint8_t sib = read_byte(cpu, cpu->seg.cs.dword, cpu->eip.dword++);
+            e = &sib_ea[m.mod == 0][sib];
+            disp_size |= e->disp_size; // Only one of the two is non-zero
+        }
+
+        switch (disp_size) {
+            case 1:
+                disp = (__int8_t)read_byte(cpu, cpu->seg.cs.dword, cpu->eip.dword);
+                break;
+            case 2:
+                disp = read_word(cpu, cpu->seg.cs.dword, cpu->eip.dword);
+                break;
+            case 4:
+                disp = read_double_word(cpu, cpu->seg.cs.dword, cpu->eip.dword);
+                break;
+        }
+        cpu->eip.dword += disp_size;
+
+        if (d) {
+            insn_record(d, INSN_EA, sib_size + disp_size);
+            d->ea = *e;
+            d->disp = disp;
+        }
+    }
+
+    __uint32_t addr = EA_REG(cpu, e->base) + (EA_REG(cpu, e->index) << e->scale) + disp;
+
+    *out_segment = EA_SREG(cpu, e->segment);
+
+    if (cpu->mode == REAL_MODE) {
+        return addr & 0xFFFF;
+    }
+    else {
+        return addr;
+    }
+}
+
+#ifdef MODRM_TABLE_VERIFY
+// The nested-switch decoder the tables replaced, kept to check them exhaustively
+// (build with -DMODRM_TABLE_VERIFY and run with --verify-modrm).
+
+__uint32_t effective_sib_address_switch(cpu_state_t *cpu, modrm_t m, sib_t s, __uint16_t* out_segment) {
+
     __uint32_t index = 0;
     __uint32_t base = 0;
 
@@ -197,12 +411,17 @@ __uint32_t effective_sib_address(cpu_state_t *cpu, modrm_t m, sib_t s, __uint16_
     return base + index;
 }
 
-__uint32_t effective_address(cpu_state_t *cpu, modrm_t m, __uint16_t* out_segment) {
+__uint32_t effective_address_switch(cpu_state_t *cpu, modrm_t m, __uint16_t* out_segment) {
     __int32_t base = 0;
     __int32_t disp = 0;
 
     bool addr32 = (cpu->mode != REAL_MODE) || (cpu->mode == REAL_MODE && cpu->prefix.x67_mode);
 
+    sib_t s = {0, 0, 0};
+    if (addr32 && m.rm == 4) { // SIB precedes the displacement
+        s = decode_sib(cpu);
+    }
+
     if (m.mod == 1) {
         disp = (__int8_t)read_byte(cpu, cpu->seg.cs.dword, cpu->eip.dword++);
     } else if (m.mod == 2) {
@@ -246,9 +465,8 @@ __uint32_t effective_address(cpu_state_t *cpu, modrm_t m, __uint16_t* out_segmen
         case 3: base = cpu->gpr.ebx.dword; *out_segment = cpu->seg.ds.dword; break;
         case 6: base = cpu->gpr.esi.dword; *out_segment = cpu->seg.ds.dword; break;
         case 7: base = cpu->gpr.edi.dword; *out_segment = cpu->seg.ds.dword; break;
-        case 4: 
-            sib_t s = decode_sib(cpu); 
-            base = effective_sib_address(cpu, m, s, out_segment); 
+        case 4:
+            base = effective_sib_address_switch(cpu, m, s, out_segment);
             break;
         case 5:
             if (m.mod == 0) {
@@ -271,6 +489,55 @@ __uint32_t effective_address(cpu_state_t *cpu, modrm_t m, __uint16_t* out_segmen
 }
 }
 
+bool verify_modrm_tables(void) { // Both decoders must agree on address, segment and bytes consumed
+    static __uint8_t memory[MEMORY_REALMODE_SIZE];
+    cpu_state_t a = {0};
+    unsigned long long checked = 0, failed = 0;
+
+    a.memory = memory;
+    a.mode = REAL_MODE;
+    a.gpr.eax.dword = 0x11111111; a.gpr.ecx.dword = 0x22222202; a.gpr.edx.dword = 0x33330303;
+    a.gpr.ebx.dword = 0x44440404; a.gpr.esp.dword = 0x5555F005; a.gpr.ebp.dword = 0x66660606;
+    a.gpr.esi.dword = 0x77770707; a.gpr.edi.dword = 0x8888F808;
+    a.seg.cs.dword = 0x1000; a.seg.ds.dword = 0x2000; a.seg.ss.dword = 0x3000;
+
+    for (int addr32 = 0; addr32 < 2; addr32++) {
+        for (int byte = 0; byte < 256; byte++) {
+            if (byte >> 6 == 3) {
+                continue; // Register operand, no address
+            }
+
+            int sib_count = (addr32 && (byte & 7) == 4) ? 256 : 1;
+            for (int sib = 0; sib < sib_count; sib++) {
+                a.prefix.x67_mode = addr32;
+                a.eip.dword = 0x100;
+
+                __uint32_t code = translate_address(&a, a.seg.cs.low16, a.eip.dword);
+                memory[code] = sib;
+                memory[code + 1] = 0x85; memory[code + 2] = 0x9A;
+                memory[code + 3] = 0xF3; memory[code + 4] = 0x7C;
+
+                modrm_t m = { byte >> 6, (byte >> 3) & 7, byte & 7, byte };
+                cpu_state_t b = a;
+                __uint16_t seg_a = 0, seg_b = 0;
+                __uint32_t ea_a = effective_address(&a, m, &seg_a);
+                __uint32_t ea_b = effective_address_switch(&b, m, &seg_b);
+
+                checked++;
+                if (ea_a != ea_b || seg_a != seg_b || a.eip.dword != b.eip.dword) {
+                    failed++;
+                    fprintf(stderr, "ModR/M mismatch: addr32 %d modrm %02X sib %02X: table %04X:%08X eip %X, switch %04X:%08X eip %X\n",
+                            addr32, byte, sib, seg_a, ea_a, a.eip.dword, seg_b, ea_b, b.eip.dword);
+                }
+            }
+        }
+    }
+
+    fprintf(stderr, "ModR/M tables: %llu encodings checked, %llu mismatches\n", checked, failed);
+    return failed == 0;
+}
+#endif
+
 __uint8_t fetch_instruction_rmode(cpu_state_t *cpu, __uint8_t *memory) {
     __uint8_t byte;
     bool prefix_active = true;
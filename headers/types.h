@@ -1,3 +1,5 @@
+#pragma once
+
 #include <stdio.h>
 #include <stdbool.h>
 
@@ -8,6 +10,13 @@ typedef unsigned short __uint16_t;
 typedef int __int32_t;
 typedef unsigned __uint32_t;
 
+#define MEMORY_REALMODE_SIZE (1024 * 1024)
+
+typedef struct replay_log replay_t;
+typedef struct tcache tcache_t;
+typedef struct vga_text vga_text_t;
+typedef struct fuzz_harness fuzz_t;
+
 typedef union {
     __uint32_t dword;
 
@@ -39,6 +48,7 @@ typedef struct {
     __uint8_t mod;
     __uint8_t reg;
     __uint8_t rm;
+    __uint8_t byte; // Raw ModR/M byte, indexes the decode tables
 } modrm_t;
 
 typedef struct {
@@ -47,6 +57,34 @@ typedef struct {
     __uint8_t base;
 } sib_t;
 
+typedef struct {
+    __uint8_t base; // Register index as in get_reg32, EA_NONE = none (reads as 0)
+    __uint8_t index; // Register index as in get_reg32, EA_NONE = none (reads as 0)
+    __uint8_t scale; // Index shift
+    __uint8_t segment; // Default Sreg index as in get_sreg
+    __uint8_t disp_size; // Displacement bytes: 0, 1 (sign-extended), 2 or 4
+    bool sib; // A SIB byte follows the ModR/M byte
+} ea_decode_t;
+
+#define INSN_MAX_LENGTH 15
+
+#define INSN_MODRM 0x01 // Handler consumed the ModR/M byte
+#define INSN_EA 0x02 // ... a memory operand (SIB and displacement)
+#define INSN_IMM 0x04 // ... an immediate or moffs
+#define INSN_UNCACHEABLE 0x80 // Consumed one of them twice, the entry cannot describe it
+
+typedef struct {
+    __uint8_t bytes[INSN_MAX_LENGTH]; // Raw encoding, compared with memory before a saved entry is trusted
+    __uint8_t length; // Whole instruction, 0 = empty
+    __uint8_t opcode;
+    __uint8_t prefix; // Bit 0: 0x66, bit 1: 0x67
+    __uint8_t modrm;
+    __uint8_t flags; // INSN_*
+    ea_decode_t ea; // Memory operand with the SIB byte already folded in
+    __uint32_t disp; // Sign-extended displacement
+    __uint32_t imm; // Immediate or moffs, zero-extended
+} decoded_insn_t;
+
 typedef struct {
     reg_32_t eax; // Accumulator
     reg_32_t ebx; // Base Register
@@ -67,12 +105,47 @@ typedef struct {
     reg_32_t gs; // Additional TLS
 } segmentRegisters;
 
+typedef struct {
+    unsigned long long mantissa; // Explicit integer bit in bit 63
+    __uint16_t sign_exp; // Sign in bit 15, exponent biased by 16383 in bits 0-14
+} float80_t;
+
+typedef union {
+    double d; // FPU_FAST
+    float80_t x; // FPU_EXACT
+} fpu_value_t;
+
+typedef enum {
+    FPU_FAST, // Host double arithmetic
+    FPU_EXACT // 80-bit soft-float
+} fpu_precision_t;
+
+typedef struct {
+    fpu_value_t st[8]; // Physical registers, ST(i) = st[(TOP + i) & 7]
+    __uint16_t control;
+    __uint16_t status; // TOP in bits 11-13
+    __uint16_t tag; // 2 bits per physical register, 11 = empty
+    fpu_precision_t precision;
+} fpu_state_t;
+
 typedef struct {
     baseRegisters gpr;
     reg_32_t eip;
     reg_32_t eflags;
     segmentRegisters seg;
+    fpu_state_t fpu;
     cpu_mode_t mode;
     cpu_prefix prefix;
+    __uint32_t zero; // Always 0: the register slot EA_NONE resolves to
     __uint8_t* memory;
+    unsigned long long icount; // Retired instructions
+    bool unsupported; // Fuzz mode: the last instruction hit something not emulated, end the input
+    replay_t* replay; // Record/replay log, NULL when disabled
+    tcache_t* tcache; // Persistent decode cache, NULL when disabled
+    decoded_insn_t* insn; // Decode cache entry of the current instruction, NULL when the cache is off
+    bool insn_cached; // insn is a complete decode to consume; false = the handler is filling it in
+    vga_text_t* vga; // Text mode display, NULL when disabled
+    fuzz_t* fuzz; // Persistent fuzzing harness, NULL when disabled
+    void* port_ctx;
+    __uint32_t (*port_in)(void* ctx, __uint16_t port, __uint8_t size); // I/O read device, NULL = floating bus
 } cpu_state_t;
\ No newline at end of file
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "types.h"
+#include "tools.h"
+
+// 80x25 colour text mode at 0xB8000. Stores into the buffer only set a bit for the
+// row they touch (through note_write); vga_refresh then redraws just those rows,
+// at most once per frame interval. Output goes either to the terminal with ANSI
+// cursor/colour escapes or, headless, to a dump file as plain text frames.
+
+#define VGA_TEXT_BASE 0xB8000
+#define VGA_TEXT_COLS 80
+#define VGA_TEXT_ROWS 25
+#define VGA_TEXT_SIZE (VGA_TEXT_COLS * VGA_TEXT_ROWS * 2)
+#define VGA_POLL_MASK 0xFFF // Check the refresh clock every 4096 instructions
+
+struct vga_text {
+    __uint32_t dirty_rows; // Bit n = row n changed since the last frame
+    FILE *out;
+    bool headless; // Plain text frames instead of ANSI escapes
+    unsigned long long frame_interval_us;
+    unsigned long long last_frame_us;
+    unsigned long long frames;
+};
+
+unsigned long long vga_now_us() { // Host clock; rendering is not guest-visible, so it bypasses replay
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+vga_text_t* vga_open(const char *dump_path, unsigned fps) { // dump_path NULL = render to the terminal
+    vga_text_t *vga = (vga_text_t*)calloc(1, sizeof(vga_text_t));
+    if (!vga) {
+        perror("VGA allocating failed");
+        return NULL;
+    }
+
+    if (dump_path) {
+        vga->out = fopen(dump_path, "w");
+        if (!vga->out) { perror("Cannot open VGA dump"); free(vga); return NULL; }
+        vga->headless = true;
+    } else {
+        vga->out = stdout;
+        fputs("\x1b[2J", vga->out);
+    }
+
+    vga->frame_interval_us = 1000000ULL / (fps ? fps : 1);
+    vga->dirty_rows = (1u << VGA_TEXT_ROWS) - 1; // First frame shows whatever the image preloaded
+    return vga;
+}
+
+void vga_note_write(cpu_state_t *cpu, __uint32_t phys, __uint32_t len) {
+    __uint32_t offset = phys - VGA_TEXT_BASE; // Wraps to a huge value below the buffer
+
+    if (offset >= VGA_TEXT_SIZE && offset + len - 1 >= VGA_TEXT_SIZE) {
+        return;
+    }
+
+    __uint32_t first = (offset < VGA_TEXT_SIZE) ? offset : 0;
+    __uint32_t last = offset + len - 1 < VGA_TEXT_SIZE ? offset + len - 1 : VGA_TEXT_SIZE - 1;
+
+    for (__uint32_t row = first / (VGA_TEXT_COLS * 2); row <= last / (VGA_TEXT_COLS * 2); row++) {
+        cpu->vga->dirty_rows |= 1u << row;
+    }
+}
+
+void vga_render(cpu_state_t *cpu) { // Draw the dirty rows now, ignoring the frame cap
+    vga_text_t *vga = cpu->vga;
+    // VGA colour index -> ANSI colour index
+    static const __uint8_t ansi[8] = { 0, 4, 2, 6, 1, 5, 3, 7 };
+
+    if (vga->headless) {
+        fprintf(vga->out, "--- frame %llu icount %llu ---\n", vga->frames, cpu->icount);
+    }
+
+    for (int row = 0; row < VGA_TEXT_ROWS; row++) {
+        if (!(vga->dirty_rows & (1u << row))) {
+            continue;
+        }
+
+        __uint8_t *cells = &cpu->memory[VGA_TEXT_BASE + row * VGA_TEXT_COLS * 2];
+        int attr = -1;
+
+        if (vga->headless) {
+            fprintf(vga->out, "%02d|", row);
+        } else {
+            fprintf(vga->out, "\x1b[%d;1H", row + 1);
+        }
+
+        for (int col = 0; col < VGA_TEXT_COLS; col++) {
+            __uint8_t ch = cells[col * 2];
+            __uint8_t cell_attr = cells[col * 2 + 1];
+
+            if (!vga->headless && cell_attr != attr) {
+                attr = cell_attr;
+                fprintf(vga->out, "\x1b[0;%d;%dm", (attr & 0x08 ? 90 : 30) + ansi[attr & 0x07], 40 + ansi[(attr >> 4) & 0x07]);
+            }
+
+            fputc(ch == 0x00 ? ' ' : (ch < 0x20 || ch > 0x7E) ? '.' : ch, vga->out);
+        }
+
+        if (vga->headless) {
+            fputc('\n', vga->out);
+        }
+    }
+
+    if (!vga->headless) {
+        fputs("\x1b[0m", vga->out);
+    }
+    fflush(vga->out);
+
+    vga->dirty_rows = 0;
+    vga->frames++;
+}
+
+void vga_refresh(cpu_state_t *cpu) { // Called periodically from the execute loop
+    vga_text_t *vga = cpu->vga;
+
+    if (!vga->dirty_rows) {
+        return;
+    }
+
+    unsigned long long now = vga_now_us();
+    if (now - vga->last_frame_us < vga->frame_interval_us) {
+        return;
+    }
+
+    vga->last_frame_us = now;
+    vga_render(cpu);
+}
+
+void vga_close(cpu_state_t *cpu) { // Flush the final frame and release the device
+    vga_text_t *vga = cpu->vga;
+
+    if (vga->dirty_rows) {
+        vga_render(cpu);
+    }
+
+    if (vga->headless) {
+        fclose(vga->out);
+    } else {
+        fprintf(vga->out, "\x1b[%d;1H", VGA_TEXT_ROWS + 1);
+        fflush(vga->out);
+    }
+
+    free(vga);
+    cpu->vga = NULL;
+}
@@ -2,39 +2,243 @@
 #include <stdbool.h>
 #include <stdlib.h>
 #include <memory.h>
+#include <string.h>
 #include "headers/functions.h"
 #include "headers/tools.h"
-
-#define MEMORY_REALMODE_SIZE 1024 * 1024
+#include "headers/replay.h"
+#include "headers/tcache.h"
+#include "headers/vga.h"
+#include "headers/fpu.h"
+#include "headers/fuzz.h"
+#include <unistd.h>
 
 void execute_instructions(cpu_state_t *cpu, __uint8_t *memory, Opcodes* opcodes) {
     while (true) {
-        __uint8_t opcode = fetch_instruction_rmode(cpu, memory);
+        if (cpu->fuzz && fuzz_step(cpu)) {
+            break;
+        }
+
+        __uint8_t opcode = cpu->tcache ? tcache_fetch(cpu, memory) : fetch_instruction_rmode(cpu, memory);
 
         if (opcode == 0x00) {
             break;
         }
 
+        if (!opcodes[opcode]) {
+            if (!cpu->fuzz) {
+                fprintf(stderr, "Unimplemented opcode %02X at %04X:%04X\n", opcode, cpu->seg.cs.low16, cpu->eip.low16 - 1);
+            }
+            break;
+        }
+
         opcodes[opcode](cpu, opcode);
+        if (cpu->unsupported) {
+            break;
+        }
+        if (cpu->tcache) {
+            tcache_retire(cpu);
+        }
+        cpu->icount++;
+
+        if (cpu->vga && (cpu->icount & VGA_POLL_MASK) == 0) {
+            vga_refresh(cpu);
+        }
+    }
+}
+
+unsigned long long fuzz_one_input(cpu_state_t *cpu, Opcodes* opcodes, const __uint8_t *data, size_t len) { // Persistent fuzzing entry point
+    fuzz_reset(cpu, data, len);
+    execute_instructions(cpu, cpu->memory, opcodes);
+    return cpu->icount;
+}
+
+#define FUZZ_MAX_INPUT (64 * 1024)
+
+void fuzz_loop(cpu_state_t *cpu, Opcodes* opcodes, unsigned long long bench_inputs) { // stdin inputs, or random ones with bench_inputs
+    static __uint8_t input[FUZZ_MAX_INPUT];
+
+    if (bench_inputs) {
+        unsigned long long seed = 0x9E3779B97F4A7C15ULL;
+        unsigned long long instructions = 0;
+        struct timespec t0, t1;
+
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        for (unsigned long long n = 0; n < bench_inputs; n++) {
+            size_t len = 1 + seed % 256;
+            for (size_t i = 0; i < len; i++) {
+                seed ^= seed << 13;
+                seed ^= seed >> 7;
+                seed ^= seed << 17;
+                input[i] = seed & 0xFF;
+            }
+            instructions += fuzz_one_input(cpu, opcodes, input, len);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+
+        double seconds = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+        printf("fuzz-bench: %llu execs in %.3f s (%.0f execs/s), %llu instructions, %u map entries hit\n",
+               bench_inputs, seconds, bench_inputs / seconds, instructions, fuzz_coverage(cpu->fuzz));
+        return;
+    }
+
+#ifdef __AFL_HAVE_MANUAL_CONTROL
+    __AFL_INIT();
+    while (__AFL_LOOP(10000)) {
+#endif
+        size_t len = 0;
+        ssize_t got;
+        while (len < sizeof(input) && (got = read(0, input + len, sizeof(input) - len)) > 0) {
+            len += got;
+        }
+        fuzz_one_input(cpu, opcodes, input, len);
+#ifdef __AFL_HAVE_MANUAL_CONTROL
+    }
+#endif
+}
+
+#define FPU_BENCH_REPEAT 1000
+
+void fpu_bench(Opcodes* opcodes, unsigned iterations) { // Same x87 workload in both precision modes
+    static const __uint8_t body[] = {
+        0xDD, 0x06, 0x00, 0x80, // FLD qword [0x8000]      x
+        0xDC, 0x0E, 0x08, 0x80, // FMUL qword [0x8008]     x * k
+        0xDC, 0x06, 0x10, 0x80, // FADD qword [0x8010]     x * k + c
+        0xD9, 0xC0,             // FLD ST(0)
+        0xDC, 0x36, 0x08, 0x80, // FDIV qword [0x8008]
+        0xD8, 0xE1,             // FSUB ST(0), ST(1)
+        0xDC, 0x1E, 0x10, 0x80, // FCOMP qword [0x8010]
+        0xDF, 0xE0,             // FNSTSW AX
+        0xDD, 0x1E, 0x00, 0x80  // FSTP qword [0x8000]     x = x * k + c
+    };
+    static const double data[3] = { 1.0, 0.999, 0.0011 }; // x, k, c
+    static const char *names[2] = { "fast", "exact" };
+    double seconds[2];
+
+    cpu_state_t cpu;
+    memset(&cpu, 0, sizeof(cpu));
+    cpu.memory = (__uint8_t*)malloc(MEMORY_REALMODE_SIZE * sizeof(__uint8_t));
+    if (!cpu.memory) {
+        perror("Memory allocating failed");
+        return;
+    }
+    cpu.mode = REAL_MODE;
+
+    for (int mode = FPU_FAST; mode <= FPU_EXACT; mode++) {
+        memset(cpu.memory, 0, MEMORY_REALMODE_SIZE * sizeof(__uint8_t));
+        for (int i = 0; i < FPU_BENCH_REPEAT; i++) {
+            memcpy(&cpu.memory[0x20000 + i * sizeof(body)], body, sizeof(body));
+        }
+        memcpy(&cpu.memory[0x8000], data, sizeof(data));
+
+        fpu_init(&cpu, mode);
+        cpu.icount = 0;
+
+        struct timespec t0, t1;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        for (unsigned it = 0; it < iterations; it++) {
+            cpu.seg.cs.dword = 0x2000;
+            cpu.eip.dword = 0;
+            execute_instructions(&cpu, cpu.memory, opcodes);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+
+        double x;
+        memcpy(&x, &cpu.memory[0x8000], sizeof(x));
+        seconds[mode] = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+        printf("fpu-bench %-5s: %llu instructions in %.3f s (%.1f Minstr/s), x = %.17g, status %04X\n",
+               names[mode], cpu.icount, seconds[mode], cpu.icount / seconds[mode] / 1e6, x, cpu.fpu.status);
     }
+
+    printf("fpu-bench exact/fast time: %.2fx\n", seconds[FPU_EXACT] / seconds[FPU_FAST]);
+    free(cpu.memory);
 }
 
-int main() {
+int main(int argc, char **argv) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    const char *record_path = NULL;
+    const char *replay_path = NULL;
+    const char *tcache_path = NULL;
+    const char *vga_dump_path = NULL;
+    bool vga_enabled = false;
+    unsigned vga_fps = 30;
+    fpu_precision_t fpu_precision = FPU_FAST;
+    bool fpu_given = false;
+    bool fuzz_mode = false;
+    bool fuzz_via_port = false;
+    __uint32_t fuzz_where = 0x0000;
+    unsigned long long fuzz_budget = 100000;
+    unsigned long long fuzz_bench_inputs = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            record_path = argv[++i];
+        } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            replay_path = argv[++i];
+        } else if (strcmp(argv[i], "--tcache") == 0 && i + 1 < argc) {
+            tcache_path = argv[++i];
+#ifdef MODRM_TABLE_VERIFY
+        } else if (strcmp(argv[i], "--verify-modrm") == 0) {
+            return verify_modrm_tables() ? 0 : 1;
+#endif
+        } else if (strcmp(argv[i], "--fpu") == 0 && i + 1 < argc && (strcmp(argv[i + 1], "fast") == 0 || strcmp(argv[i + 1], "exact") == 0)) {
+            fpu_precision = strcmp(argv[++i], "exact") == 0 ? FPU_EXACT : FPU_FAST;
+            fpu_given = true;
+        } else if (strcmp(argv[i], "--fpu-bench") == 0 && i + 1 < argc) {
+            Opcodes opcodes[256] = {NULL};
+            init_opcodes(opcodes);
+            fpu_bench(opcodes, (unsigned)atoi(argv[++i]));
+            return 0;
+        } else if (strcmp(argv[i], "--fuzz") == 0) {
+            fuzz_mode = true;
+        } else if (strcmp(argv[i], "--fuzz-bench") == 0 && i + 1 < argc) {
+            fuzz_mode = true;
+            fuzz_bench_inputs = strtoull(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--fuzz-addr") == 0 && i + 1 < argc) {
+            fuzz_via_port = false;
+            fuzz_where = strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--fuzz-port") == 0 && i + 1 < argc) {
+            fuzz_via_port = true;
+            fuzz_where = strtoul(argv[++i], NULL, 0) & 0xFFFF;
+        } else if (strcmp(argv[i], "--fuzz-budget") == 0 && i + 1 < argc) {
+            fuzz_budget = strtoull(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--vga") == 0) {
+            vga_enabled = true;
+        } else if (strcmp(argv[i], "--vga-dump") == 0 && i + 1 < argc) {
+            vga_enabled = true;
+            vga_dump_path = argv[++i];
+        } else if (strcmp(argv[i], "--vga-fps") == 0 && i + 1 < argc) {
+            vga_fps = (unsigned)atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "Usage: %s [--record <log> | --replay <log>] [--tcache <file>] [--vga | --vga-dump <file>] [--vga-fps <n>] [--fpu fast|exact] [--fpu-bench <iterations>]\n"
+                            "       [--fuzz | --fuzz-bench <inputs>] [--fuzz-addr <addr> | --fuzz-port <port>] [--fuzz-budget <instructions>]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (fuzz_mode && (record_path || replay_path || tcache_path || vga_enabled)) {
+        fprintf(stderr, "--fuzz cannot be combined with --record, --replay, --tcache or --vga\n");
+        return 1;
+    }
+
     FILE *f = fopen("test.bin", "rb");
-    if (!f) { perror("Connot open file"); return 1; };
+    if (!f && !fuzz_mode) { perror("Connot open file"); return 1; }; // Fuzzing may run the input itself as the program
 
     cpu_state_t cpu;
     cpu.memory = (__uint8_t*)malloc(MEMORY_REALMODE_SIZE * sizeof(__uint8_t));
     if (!cpu.memory) {
         perror("Memory allocating failed");
-        fclose(f);
+        if (f) fclose(f);
         return -1;
     }
     
     memset(cpu.memory, 0, MEMORY_REALMODE_SIZE * sizeof(__uint8_t));
 
-    size_t n = fread(&cpu.memory[0x00], 1, 512, f);
-    fclose(f);
+    if (f) {
+        size_t n = fread(&cpu.memory[0x00], 1, 512, f);
+        fclose(f);
+    }
 
     cpu.gpr.eax.dword = 0;
     cpu.gpr.ebx.dword = 0;
@@ -56,16 +260,72 @@ int main() {
     cpu.eflags.dword = 0x0002;
 
     cpu.mode = REAL_MODE;
+    cpu.zero = 0;
+    cpu.icount = 0;
+    cpu.unsupported = false;
+    cpu.port_ctx = NULL;
+    cpu.port_in = NULL;
+    cpu.replay = NULL;
+    cpu.tcache = NULL;
+    cpu.insn = NULL;
+    cpu.insn_cached = false;
+    cpu.vga = NULL;
+    cpu.fuzz = NULL;
+    fpu_init(&cpu, fpu_precision);
+
+    if (fuzz_mode) {
+        Opcodes opcodes[256] = {NULL};
+        init_opcodes(opcodes);
+
+        if (!fuzz_open(&cpu, fuzz_via_port, fuzz_where, fuzz_budget)) {
+            free(cpu.memory);
+            return 1;
+        }
+        fuzz_loop(&cpu, opcodes, fuzz_bench_inputs);
+        fuzz_close(&cpu);
+
+        free(cpu.memory);
+        return 0;
+    }
+
+    if (record_path || replay_path) {
+        cpu.replay = replay_open(&cpu, record_path ? record_path : replay_path, record_path ? REPLAY_RECORD : REPLAY_PLAYBACK, fpu_given);
+        if (!cpu.replay) {
+            free(cpu.memory);
+            return 1;
+        }
+    }
+
+    if (tcache_path) {
+        cpu.tcache = tcache_open(&cpu, tcache_path, start);
+    }
+
+    if (vga_enabled) {
+        cpu.vga = vga_open(vga_dump_path, vga_fps);
+    }
 
     Opcodes opcodes[256] = {NULL};
     init_opcodes(opcodes);
 
     execute_instructions(&cpu, cpu.memory, opcodes);
 
+    if (cpu.tcache) {
+        tcache_close(&cpu);
+    }
+
+    if (cpu.vga) {
+        vga_close(&cpu);
+    }
+
+    bool replay_ok = true;
+    if (cpu.replay) {
+        replay_ok = replay_close(&cpu);
+    }
+
     free(cpu.memory);
     cpu.memory = NULL;
 
     printf("EAX: %d \n EBX: %d \n ECX: %d \n EDX: %d \n ESI: %d \n EDI: %d \n EBP: %d \n ESP: %d \n", cpu.gpr.eax, cpu.gpr.ebx, cpu.gpr.ecx, cpu.gpr.edx, cpu.gpr.esi, cpu.gpr.edi, cpu.gpr.ebp, cpu.gpr.esp);
 
-    return 0;
+    return replay_ok ? 0 : 2;
 }
\ No newline at end of file